@@ -235,11 +235,17 @@ consoleintr(int (*getc)(void))
 int
 consoleread(struct inode *ip, char *dst, int n)
 {
+  char buf[INPUT_BUF];
   uint target;
-  int c;
+  int c, i;
 
+  // dst is user memory, which is not touched with cons.lock held.
+  // A line fits in buf, so at most that much is read at once.
+  if(n > INPUT_BUF)
+    n = INPUT_BUF;
   iunlock(ip);
   target = n;
+  i = 0;
   acquire(&cons.lock);
   while(n > 0){
     while(input.r == input.w){
@@ -259,12 +265,13 @@ consoleread(struct inode *ip, char *dst, int n)
       }
       break;
     }
-    *dst++ = c;
+    buf[i++] = c;
     --n;
     if(c == '\n')
       break;
   }
   release(&cons.lock);
+  memmove(dst, buf, i);
   ilock(ip);
 
   return target - n;
@@ -273,13 +280,20 @@ consoleread(struct inode *ip, char *dst, int n)
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
-  int i;
+  char kbuf[128];
+  int i, j, m;
 
+  // Copy buf, which is user memory, through kbuf so that it is
+  // not touched with cons.lock held.
   iunlock(ip);
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++)
-    consputc(buf[i] & 0xff);
-  release(&cons.lock);
+  for(i = 0; i < n; i += m){
+    m = n - i < sizeof(kbuf) ? n - i : sizeof(kbuf);
+    memmove(kbuf, buf + i, m);
+    acquire(&cons.lock);
+    for(j = 0; j < m; j++)
+      consputc(kbuf[j] & 0xff);
+    release(&cons.lock);
+  }
   ilock(ip);
 
   return n;
@@ -0,0 +1,230 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+#include "coro.h"
+
+#define SPINS 200  // empty run queue checks before a carrier parks
+
+struct {
+  volatile uint lock;          // protects runq and freelist
+  struct coro *head, *tail;    // run queue
+  struct coro *freelist;       // stacks of finished coroutines
+  volatile int live;           // spawned and not yet finished
+  volatile int nparked;        // carriers sleeping in futex_wait
+  volatile int wakeseq;        // futex word for parked carriers
+  struct carrier carrier[CO_MAXCARRIER];
+} co;
+
+static void
+lock(void)
+{
+  while(xchg(&co.lock, 1) != 0)
+    ;
+}
+
+static void
+unlock(void)
+{
+  __sync_synchronize();
+  co.lock = 0;
+}
+
+static void
+wake(int all)
+{
+  __sync_synchronize();
+  if(all || co.nparked > 0){
+    __sync_fetch_and_add(&co.wakeseq, 1);
+    futex_wake((int*)&co.wakeseq);
+  }
+}
+
+// The running coroutine sits at the bottom of the stack we are on.
+static struct coro*
+co_self(void)
+{
+  uint sp;
+
+  sp = (uint)&sp;
+  return (struct coro*)(sp & ~(COSTACK-1));
+}
+
+// Take a COSTACK-aligned stack off the free list, carving a new
+// chunk out of the heap when it is empty. Caller holds co.lock.
+static struct coro*
+stackalloc(void)
+{
+  struct coro *c;
+  char *p;
+  int i;
+
+  if(co.freelist == 0){
+    if((p = malloc((COCHUNK+1) * COSTACK)) == 0)
+      return 0;
+    p = (char*)(((uint)p + COSTACK-1) & ~(COSTACK-1));
+    for(i = 0; i < COCHUNK; i++){
+      c = (struct coro*)(p + i*COSTACK);
+      c->next = co.freelist;
+      co.freelist = c;
+    }
+  }
+  c = co.freelist;
+  co.freelist = c->next;
+  return c;
+}
+
+static void
+enqueue(struct coro *c)
+{
+  c->next = 0;
+  if(co.tail)
+    co.tail->next = c;
+  else
+    co.head = c;
+  co.tail = c;
+}
+
+static struct coro*
+dequeue(void)
+{
+  struct coro *c;
+
+  if((c = co.head) != 0){
+    co.head = c->next;
+    if(co.head == 0)
+      co.tail = 0;
+  }
+  return c;
+}
+
+// First code a new coroutine runs, via the eip in its context.
+static void
+co_start(void)
+{
+  struct coro *c = co_self();
+
+  c->fn(c->arg);
+  c->state = CO_DEAD;
+  coswtch(&c->context, c->carrier->context);
+}
+
+// Create a coroutine running fn(arg). It starts the next time a
+// carrier picks it from the run queue.
+int
+co_spawn(void (*fn)(void*), void *arg)
+{
+  struct coro *c;
+  char *sp;
+
+  lock();
+  if((c = stackalloc()) == 0){
+    unlock();
+    return -1;
+  }
+  c->fn = fn;
+  c->arg = arg;
+  c->state = CO_RUNNABLE;
+  c->carrier = 0;
+
+  // Set up the stack so that coswtch() returns into co_start.
+  sp = (char*)c + COSTACK;
+  sp -= 4;
+  *(uint*)sp = 0xffffffff;  // fake return PC
+  sp -= sizeof *c->context;
+  c->context = (struct cocontext*)sp;
+  memset(c->context, 0, sizeof *c->context);
+  c->context->eip = (uint)co_start;
+
+  __sync_fetch_and_add(&co.live, 1);
+  enqueue(c);
+  unlock();
+  wake(0);
+  return 0;
+}
+
+// Give up the carrier. Only valid inside a coroutine.
+void
+co_yield(void)
+{
+  struct coro *c = co_self();
+
+  c->state = CO_RUNNABLE;
+  coswtch(&c->context, c->carrier->context);
+}
+
+// Run coroutines until every one of them has finished.
+static void*
+carry(void *arg)
+{
+  struct carrier *k = arg;
+  struct coro *c;
+  int spins = 0, seq;
+
+  for(;;){
+    lock();
+    c = dequeue();
+    unlock();
+    if(c == 0){
+      if(co.live == 0)
+        break;
+      if(++spins < SPINS)
+        continue;
+      seq = co.wakeseq;
+      __sync_fetch_and_add(&co.nparked, 1);
+      if(co.head == 0 && co.live != 0)
+        futex_wait((int*)&co.wakeseq, seq);
+      __sync_fetch_and_sub(&co.nparked, 1);
+      spins = 0;
+      continue;
+    }
+    spins = 0;
+
+    c->carrier = k;
+    c->state = CO_RUNNING;
+    coswtch(&k->context, c->context);
+
+    // Only requeue or free c now that we are off its stack.
+    if(c->state == CO_DEAD){
+      lock();
+      c->next = co.freelist;
+      co.freelist = c;
+      unlock();
+      if(__sync_sub_and_fetch(&co.live, 1) == 0)
+        wake(1);
+    } else {
+      lock();
+      enqueue(c);
+      unlock();
+      wake(0);
+    }
+  }
+  if(k != &co.carrier[0])
+    thread_exit(0);
+  return 0;
+}
+
+// Run spawned coroutines on ncarrier LWPs, one of which is the
+// caller. Returns when all coroutines, including ones spawned
+// along the way, have finished.
+void
+co_run(int ncarrier)
+{
+  void *retval;
+  int i;
+
+  if(ncarrier < 1)
+    ncarrier = 1;
+  if(ncarrier > CO_MAXCARRIER)
+    ncarrier = CO_MAXCARRIER;
+  for(i = 1; i < ncarrier; i++){
+    if(thread_create(&co.carrier[i].thread, carry, &co.carrier[i]) != 0){
+      printf(2, "co_run: thread_create failed\n");
+      ncarrier = i;
+      break;
+    }
+  }
+  carry(&co.carrier[0]);
+  for(i = 1; i < ncarrier; i++)
+    thread_join(co.carrier[i].thread, &retval);
+}
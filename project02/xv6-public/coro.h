@@ -0,0 +1,42 @@
+// M:N coroutines (green threads) multiplexed over a few LWPs.
+// Coroutines are scheduled cooperatively: one runs on a carrier
+// LWP until it calls co_yield() or returns. A coroutine that makes
+// a blocking system call blocks its whole carrier.
+
+#define CO_MAXCARRIER 8
+#define COSTACK       4096  // per-coroutine stack, also its alignment
+#define COCHUNK       64    // stacks allocated at a time
+
+enum costate { CO_RUNNABLE, CO_RUNNING, CO_DEAD };
+
+// Saved registers, laid out as coswtch.S pushes them.
+struct cocontext {
+  uint edi;
+  uint esi;
+  uint ebx;
+  uint ebp;
+  uint eip;
+};
+
+struct carrier;
+
+// Lives at the bottom of the coroutine's own stack.
+struct coro {
+  struct cocontext *context;   // coswtch() here to run coroutine
+  enum costate state;
+  void (*fn)(void*);
+  void *arg;
+  struct coro *next;           // run queue or free list
+  struct carrier *carrier;     // carrier running the coroutine
+};
+
+struct carrier {
+  struct cocontext *context;   // coswtch() here to get back to carrier
+  thread_t thread;
+};
+
+void coswtch(struct cocontext**, struct cocontext*);
+
+int co_spawn(void (*fn)(void*), void *arg);
+void co_yield(void);
+void co_run(int ncarrier);
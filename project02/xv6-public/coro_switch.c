@@ -0,0 +1,102 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "coro.h"
+
+// Compare a coroutine switch with an LWP switch, then show that
+// thousands of coroutines fit in one process.
+
+#define CO_SWITCHES   200000
+#define LWP_SWITCHES  4000
+#define NTASK         2000
+#define TASK_YIELDS   10
+
+volatile int turn;
+volatile int done;
+
+void
+pingpong(void *arg)
+{
+  int i;
+
+  for(i = 0; i < CO_SWITCHES/2; i++)
+    co_yield();
+}
+
+void *
+lwp_pong(void *arg)
+{
+  int i;
+
+  for(i = 0; i < LWP_SWITCHES/2; i++){
+    while(turn != 1)
+      futex_wait((int*)&turn, 0);
+    turn = 0;
+    futex_wake((int*)&turn);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void
+task(void *arg)
+{
+  int i;
+
+  for(i = 0; i < TASK_YIELDS; i++)
+    co_yield();
+  __sync_fetch_and_add(&done, 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_t t;
+  void *retval;
+  int i, start, coticks, lwpticks, ncarrier;
+
+  ncarrier = 2;
+  if(argc > 1)
+    ncarrier = atoi(argv[1]);
+
+  // Two coroutines yielding to each other on one carrier.
+  co_spawn(pingpong, 0);
+  co_spawn(pingpong, 0);
+  start = uptime();
+  co_run(1);
+  coticks = uptime() - start;
+
+  // Two LWPs handing a futex back and forth.
+  turn = 0;
+  if(thread_create(&t, lwp_pong, 0) != 0){
+    printf(1, "thread_create failed!\n");
+    exit();
+  }
+  start = uptime();
+  for(i = 0; i < LWP_SWITCHES/2; i++){
+    turn = 1;
+    futex_wake((int*)&turn);
+    while(turn != 0)
+      futex_wait((int*)&turn, 1);
+  }
+  lwpticks = uptime() - start;
+  thread_join(t, &retval);
+
+  printf(1, "coroutine: %d switches in %d ticks\n", CO_SWITCHES, coticks);
+  printf(1, "LWP:       %d switches in %d ticks\n", LWP_SWITCHES, lwpticks);
+
+  // Many coroutines over a few carriers.
+  for(i = 0; i < NTASK; i++){
+    if(co_spawn(task, 0) < 0){
+      printf(1, "co_spawn failed at %d\n", i);
+      exit();
+    }
+  }
+  start = uptime();
+  co_run(ncarrier);
+  printf(1, "%d coroutines x %d yields on %d carriers: %d ticks\n",
+         done, TASK_YIELDS, ncarrier, uptime() - start);
+  if(done != NTASK)
+    printf(1, "Test failed!\n");
+  exit();
+}
@@ -2,13 +2,19 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct memstat;
 struct pipe;
 struct proc;
+struct shmmap;
+struct shmseg;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
+struct slabcache;
+struct slabstat;
 struct stat;
 struct superblock;
+struct vmseg;
 
 // bio.c
 void            binit(void);
@@ -25,6 +31,9 @@ void            panic(char*) __attribute__((noreturn));
 // exec.c
 int             exec(char*, char**);
 int             exec2(char *path, char **argv, int stacksize);
+void            freesegs(struct vmseg*);
+void            freemaps(pde_t*, struct vmseg*);
+int             spawnimage(struct proc*, char*, char**, int);
 
 // file.c
 struct file*    filealloc(void);
@@ -65,10 +74,22 @@ extern uchar    ioapicid;
 void            ioapicinit(void);
 
 // kalloc.c
+extern uint     phystop;
+extern char*    zeropg;
 char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kincref(char*);
+int             krefcount(char*);
+int             setkcache(int);
+char*           kzalloc(void);
+char*           kallocn(int);
+void            kfreen(char*, int);
+void            kzerofill(void);
+void            kmemstat(struct memstat*);
+void            regshrinker(char*, int (*)(void), int (*)(int));
+void            reclaimd(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -78,6 +99,7 @@ void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
+void            lapicipi(int, int);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
@@ -92,11 +114,19 @@ void            end_op();
 extern int      ismp;
 void            mpinit(void);
 
+// pcache.c
+void            pcinit(void);
+char*           pcget(struct inode*, uint);
+void            pcinval(struct inode*);
+void            pcwrite(struct inode*, char*, uint, uint);
+void            pcsync(struct inode*, uint, char*);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -107,8 +137,10 @@ int             pipewrite(struct pipe*, char*, int);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             spawn(char*, char**, int, int*);
 int             growproc(int);
 int             kill(int);
+void            kstackcache(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -127,6 +159,38 @@ int             thread_create(thread_t *thread, void *(*start_routine)(void *),
 void            thread_exit(void *retval);
 int             thread_join(thread_t thread, void **retval);
 int             exec_kill(int);
+int             makemain(struct proc*);
+int             setgang(int pid, int enable);
+int             setprocfair(int enable);
+int             sethugeheap(int enable);
+int             futex_wait(int *addr, int val);
+int             futex_wake(int *addr);
+int             shmattach(int id);
+int             shmdetach(uint addr);
+int             mapfile(struct inode *ip, uint off, uint len, uint filesz, int perm);
+int             unmapfile(uint addr);
+int             pageout(void);
+void            kproc(char*, void (*)(void));
+
+// shm.c
+void            shminit(void);
+int             shmget(int, uint);
+struct shmseg*  shmref(int);
+int             shmpages(struct shmseg*);
+int             shmuvm(struct shmseg*, pde_t*, uint);
+int             shmclaim(struct shmseg*, int);
+void            shmunclaim(struct shmseg*, int);
+void            shmdup(struct shmseg*);
+void            shmput(struct shmseg*);
+void            shmexit(struct shmmap*);
+void            shmdisown(struct proc*);
+
+// slab.c
+void            slabinit(void);
+struct slabcache* slabcreate(char*, uint);
+void*           slaballoc(struct slabcache*);
+void            slabfree(void*);
+int             slabinfo(struct slabstat*, int);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -155,9 +219,21 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+void            swapinit(void);
+int             swapalloc(void);
+void            swapdup(uint);
+void            swapfree(uint);
+void            swapbegin(void);
+void            swapend(void);
+void            swapread(uint, char*);
+void            swapwrite(uint, char*);
+void            swapstat(struct memstat*);
+
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argwptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -186,12 +262,24 @@ int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
+void            tlbshootdown(pde_t*);
+void            tlbflush(pde_t*);
+void            tlbpoll(void);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
-void            clearpteu(pde_t *pgdir, char *uva);
+int             guarduvm(pde_t*, uint);
+int             shareuvm(pde_t*, uint, char*);
+void            syncuvm(pde_t*, struct vmseg*);
+int             pagefault(uint, uint);
+int             faultuvm(uint, uint, int);
+int             countuvm(pde_t*, uint, uint);
+int             countswap(pde_t*, uint, uint);
+uint*           coldpage(pde_t*, uint*, uint);
+char*           evictpte(pde_t*, uint*, uint);
+int             chargeuvm(struct proc*, int);
+void            unchargeuvm(struct proc*, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
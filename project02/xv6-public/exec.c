@@ -7,28 +7,103 @@
 #include "x86.h"
 #include "elf.h"
 
-int
-exec(char *path, char **argv)
+// Record the loadable segments of the ELF file ip in seg rather
+// than reading them in; pagefault() brings each page in from the
+// file the first time it is touched. Returns the end of the
+// program image, or 0 if the file is bad.
+static uint
+mapsegs(struct inode *ip, struct elfhdr *elf, struct vmseg *seg)
 {
-  char *s, *last;
-  int i, off;
-  uint argc, sz, sp, ustack[3+MAXARG+1];
-  struct elfhdr elf;
-  struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
+  int i, n, off;
+  uint sz;
+
+  sz = 0;
+  n = 0;
+  for(i=0, off=elf->phoff; i<elf->phnum; i++, off+=sizeof(ph)){
+    if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
+      return 0;
+    if(ph.type != ELF_PROG_LOAD)
+      continue;
+    if(ph.memsz < ph.filesz)
+      return 0;
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz >= KERNBASE)
+      return 0;
+    if(ph.vaddr % PGSIZE != 0)
+      return 0;
+    if(n == NSEG)
+      return 0;
+    seg[n].ip = idup(ip);
+    seg[n].va = ph.vaddr;
+    seg[n].off = ph.off;
+    seg[n].filesz = ph.filesz;
+    seg[n].memsz = ph.memsz;
+    seg[n].perm = (ph.flags & ELF_PROG_FLAG_WRITE) ? PTE_W : 0;
+    n++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
+  }
+  return sz;
+}
+
+// Drop the program file references held by seg.
+void
+freesegs(struct vmseg *seg)
+{
+  int i;
+
+  for(i = 0; i < NSEG; i++)
+    if(seg[i].ip)
+      break;
+  if(i == NSEG)
+    return;
+  begin_op();
+  for(i = 0; i < NSEG; i++){
+    if(seg[i].ip){
+      iput(seg[i].ip);
+      seg[i].ip = 0;
+    }
+  }
+  end_op();
+}
+
+// Write back and drop the file mappings in m, whose pages are
+// mapped in pgdir.
+void
+freemaps(pde_t *pgdir, struct vmseg *m)
+{
+  int i;
 
-  if(curproc->tid > 0){
-    // Set the current thread to main thread
-    curproc->main->tid = curproc->tid;
-    curproc->tid = 0;
-    curproc->parent = curproc->main->parent;
-    curproc->main = 0;
+  for(i = 0; i < NMMAP; i++){
+    if(m[i].ip){
+      syncuvm(pgdir, &m[i]);
+      begin_op();
+      iput(m[i].ip);
+      end_op();
+      m[i].ip = 0;
+    }
   }
+}
 
-  // Kill all threads of the process except the current process(thread)
-  exec_kill(curproc->pid);
+// A program image being built for a process.
+struct image {
+  pde_t *pgdir;
+  uint sz;
+  uint sp;
+  uint entry;
+  struct vmseg seg[NSEG];
+};
+
+// Build a new address space that runs the program path with
+// arguments argv and room for a stack of stacksize pages. Fails
+// if the program is bad or would use more than memlim bytes.
+static int
+loadimage(char *path, char **argv, int stacksize, int memlim, struct image *im)
+{
+  uint argc, sz, sp, ustack[3+MAXARG+1];
+  struct elfhdr elf;
+  struct inode *ip;
+  pde_t *pgdir;
 
   begin_op();
 
@@ -39,6 +114,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  memset(im->seg, 0, sizeof(im->seg));
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -49,34 +125,22 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
-  sz = 0;
-  for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
-    if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
-      goto bad;
-    if(ph.type != ELF_PROG_LOAD)
-      continue;
-    if(ph.memsz < ph.filesz)
-      goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
-      goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
-    if(ph.vaddr % PGSIZE != 0)
-      goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
-      goto bad;
-  }
+  // Map the program; its pages are read in when first used.
+  if((sz = mapsegs(ip, &elf, im->seg)) == 0)
+    goto bad;
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible.  Use the second as the user stack.
+  // Leave a guard gap at the next page boundary and reserve
+  // stacksize pages above it. Only the top page is allocated now;
+  // pagefault() fills in the rest as the stack grows down.
   sz = PGROUNDUP(sz);
-  if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0)
+  if(guarduvm(pgdir, sz) < 0)
+    goto bad;
+  sz += (stacksize+1)*PGSIZE;
+  if(allocuvm(pgdir, sz - PGSIZE, sz) == 0)
     goto bad;
-  clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
   sp = sz;
 
   // Push argument strings, prepare rest of stack in ustack.
@@ -98,21 +162,13 @@ exec(char *path, char **argv)
   if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
     goto bad;
 
-  // Save program name for debugging.
-  for(last=s=path; *s; s++)
-    if(*s == '/')
-      last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  if(memlim && countuvm(pgdir, 0, sz) * PGSIZE > memlim)
+    goto bad;
 
-  // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  curproc->stacksize = 1;
-  switchuvm(curproc);
-  freevm(oldpgdir);
+  im->pgdir = pgdir;
+  im->sz = sz;
+  im->sp = sp;
+  im->entry = elf.entry;
   return 0;
 
  bad:
@@ -122,131 +178,84 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  freesegs(im->seg);
   return -1;
 }
 
-int
-exec2(char *path, char **argv, int stacksize)
+// Point p at the user image im. The segments are left to the caller.
+static void
+setimage(struct proc *p, struct image *im, char *path, int stacksize)
 {
   char *s, *last;
-  int i, off;
-  uint argc, sz, sp, ustack[3+MAXARG+1];
-  struct elfhdr elf;
-  struct inode *ip;
-  struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
-
-  if(curproc->tid > 0){
-    // Set the current thread to main thread
-    curproc->main->tid = curproc->tid;
-    curproc->tid = 0;
-    curproc->parent = curproc->main->parent;
-    curproc->main = 0;
-  }
-
-  // Kill all threads of the process except the current process(thread)
-  exec_kill(curproc->pid);
 
-  begin_op();
-
-  if((ip = namei(path)) == 0){
-    end_op();
-    cprintf("exec: fail\n");
-    return -1;
-  }
-  ilock(ip);
-  pgdir = 0;
+  // Save program name for debugging.
+  for(last=s=path; *s; s++)
+    if(*s == '/')
+      last = s+1;
+  safestrcpy(p->name, last, sizeof(p->name));
 
-  // Check ELF header
-  if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
-    goto bad;
-  if(elf.magic != ELF_MAGIC)
-    goto bad;
+  p->pgdir = im->pgdir;
+  p->sz = im->sz;
+  p->rss = countuvm(im->pgdir, 0, im->sz);
+  p->tf->eip = im->entry;  // main
+  p->tf->esp = im->sp;
+  p->stacksize = stacksize; // most stack pages it may use
+  p->ustack = im->sz;
+  p->hugeheap = 0;
+}
 
-  if((pgdir = setupkvm()) == 0)
-    goto bad;
+int
+exec(char *path, char **argv)
+{
+  return exec2(path, argv, 1);
+}
 
-  // Load program into memory.
-  sz = 0;
-  for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
-    if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
-      goto bad;
-    if(ph.type != ELF_PROG_LOAD)
-      continue;
-    if(ph.memsz < ph.filesz)
-      goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
-      goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
-    if(ph.vaddr % PGSIZE != 0)
-      goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
-      goto bad;
-  }
-  iunlockput(ip);
-  end_op();
-  ip = 0;
+int
+exec2(char *path, char **argv, int stacksize)
+{
+  struct image im;
+  pde_t *oldpgdir;
+  struct proc *curproc = myproc();
 
   // Check if stacksize is in range
   if(stacksize <1 || stacksize >100){
     cprintf("[exec2] stacksize is out of range!\n");
     return -1;
   }
-  
-  stacksize++; // for guard page
-
-  // Allocate stack pages at the next page boundary.
-  // Make the first inaccessible. Use the remaining pages as the user stack.
-  sz = PGROUNDUP(sz);
-  if((sz = allocuvm(pgdir, sz, sz + stacksize*PGSIZE)) == 0)
-    goto bad;
-  clearpteu(pgdir, (char*)(sz - stacksize*PGSIZE));
-  sp = sz;
-
-  // Push argument strings, prepare rest of stack in ustack.
-  for(argc = 0; argv[argc]; argc++) {
-    if(argc >= MAXARG)
-      goto bad;
-    sp = (sp - (strlen(argv[argc]) + 1)) & ~3;
-    if(copyout(pgdir, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
-      goto bad;
-    ustack[3+argc] = sp;
-  }
-  ustack[3+argc] = 0;
 
-  ustack[0] = 0xffffffff;  // fake return PC
-  ustack[1] = argc;
-  ustack[2] = sp - (argc+1)*4;  // argv pointer
-
-  sp -= (3+argc+1) * 4;
-  if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
-    goto bad;
+  // Kill all threads of the process except the current process(thread),
+  // which becomes the main thread
+  if(exec_kill(curproc->pid) < 0)
+    return -1;
 
-  // Save program name for debugging.
-  for(last=s=path; *s; s++)
-    if(*s == '/')
-      last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  if(loadimage(path, argv, stacksize, curproc->memlim, &im) < 0)
+    return -1;
 
-  // Commit to the user image.
+  // Commit to the user image. The segments this process owns
+  // are uncharged before setimage counts its new size.
+  shmdisown(curproc);
   oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  curproc->stacksize = stacksize - 1; // store number of stack pages
+  setimage(curproc, &im, path, stacksize);
   switchuvm(curproc);
+  freemaps(oldpgdir, curproc->mmap);
   freevm(oldpgdir);
+  freesegs(curproc->seg);
+  memmove(curproc->seg, im.seg, sizeof(im.seg));
+  shmexit(curproc->shm);
   return 0;
+}
 
- bad:
-  if(pgdir)
-    freevm(pgdir);
-  if(ip){
-    iunlockput(ip);
-    end_op();
-  }
-  return -1;
-}
\ No newline at end of file
+// Load the program path into p, a new process that has no user
+// memory yet, as exec2 would. spawn() uses this to start a child
+// without first copying the parent.
+int
+spawnimage(struct proc *p, char *path, char **argv, int stacksize)
+{
+  struct image im;
+
+  if(loadimage(path, argv, stacksize, p->memlim, &im) < 0)
+    return -1;
+  setimage(p, &im, path, stacksize);
+  memmove(p->seg, im.seg, sizeof(im.seg));
+  return 0;
+}
@@ -0,0 +1,42 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Time fork()+exec() of a large program that exits right away,
+// and of the same program touching all of its pages. With
+// demand-paged exec the first should not pay for the whole file.
+
+#define ITERS 100
+
+int
+run(char **args)
+{
+  int i, pid, start;
+
+  start = uptime();
+  for(i = 0; i < ITERS; i++){
+    if((pid = fork()) < 0){
+      printf(1, "fork failed!\n");
+      exit();
+    }
+    if(pid == 0){
+      exec(args[0], args);
+      printf(1, "exec %s failed!\n", args[0]);
+      exit();
+    }
+    wait();
+  }
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *quick[] = { "execbig", 0 };
+  char *touch[] = { "execbig", "touch", 0 };
+
+  printf(1, "exec_bench: %d runs each\n", ITERS);
+  printf(1, "startup only:       %d ticks\n", run(quick));
+  printf(1, "touching all pages: %d ticks\n", run(touch));
+  exit();
+}
@@ -0,0 +1,25 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// A large program, most of which a normal run never touches.
+// exec_bench uses it to time program startup.
+
+#define TABLE (48*1024)
+
+char table[TABLE] = { 1 };
+
+int
+main(int argc, char *argv[])
+{
+  int i, sum;
+
+  if(argc > 1){
+    sum = 0;
+    for(i = 0; i < TABLE; i += 512)
+      sum += table[i];
+    if(sum != 1)
+      printf(1, "execbig: bad table\n");
+  }
+  exit();
+}
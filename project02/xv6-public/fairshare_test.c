@@ -0,0 +1,115 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// A 1-thread process and an N-thread process spin side by side
+// for the same number of ticks. With process-fair scheduling both
+// should get about the same amount of work done; with per-thread
+// scheduling the N-thread process gets about N times as much.
+// Run with fewer CPUs than threads (e.g. CPUS=1) to see contention.
+
+#define NUM_THREAD 4
+#define DURATION   300
+
+int start, end;
+int work[NUM_THREAD];
+thread_t thread[NUM_THREAD];
+
+void failed()
+{
+  printf(1, "Test failed!\n");
+  exit();
+}
+
+int spin(void)
+{
+  int n = 0, i;
+
+  while(uptime() < start)
+    sleep(1);
+  while(uptime() < end){
+    for(i = 0; i < 1000; i++)
+      n++;
+  }
+  return n / 1000;
+}
+
+void *thread_spin(void *arg)
+{
+  work[(int)arg] = spin();
+  thread_exit(0);
+  return 0;
+}
+
+// Fork one process per group and return their work totals.
+void measure(int *single, int *multi)
+{
+  int fd[2], i, msg[2];
+  void *retval;
+
+  if(pipe(fd) < 0)
+    failed();
+  start = uptime() + 10;
+  end = start + DURATION;
+
+  if(fork() == 0){
+    msg[0] = 1;
+    msg[1] = spin();
+    write(fd[1], msg, sizeof(msg));
+    exit();
+  }
+  if(fork() == 0){
+    for(i = 0; i < NUM_THREAD; i++){
+      if(thread_create(&thread[i], thread_spin, (void *)i) != 0){
+        printf(1, "Error creating thread %d\n", i);
+        failed();
+      }
+    }
+    msg[0] = NUM_THREAD;
+    msg[1] = 0;
+    for(i = 0; i < NUM_THREAD; i++){
+      thread_join(thread[i], &retval);
+      msg[1] += work[i];
+    }
+    write(fd[1], msg, sizeof(msg));
+    exit();
+  }
+
+  for(i = 0; i < 2; i++){
+    if(read(fd[0], msg, sizeof(msg)) != sizeof(msg))
+      failed();
+    if(msg[0] == 1)
+      *single = msg[1];
+    else
+      *multi = msg[1];
+  }
+  wait();
+  wait();
+  close(fd[0]);
+  close(fd[1]);
+}
+
+int main(int argc, char *argv[])
+{
+  int single, multi;
+
+  printf(1, "Test 1: Per-thread scheduling\n");
+  setprocfair(0);
+  measure(&single, &multi);
+  printf(1, "1 thread: %d, %d threads: %d\n", single, NUM_THREAD, multi);
+  printf(1, "Test 1 done\n\n");
+
+  printf(1, "Test 2: Process-fair scheduling\n");
+  setprocfair(1);
+  measure(&single, &multi);
+  printf(1, "1 thread: %d, %d threads: %d\n", single, NUM_THREAD, multi);
+  // Allow 25% either way.
+  if(single*4 < multi*3 || multi*4 < single*3){
+    printf(1, "Shares are not equal\n");
+    failed();
+  }
+  printf(1, "Test 2 passed\n\n");
+
+  printf(1, "All tests passed!\n");
+  exit();
+}
@@ -2,3 +2,6 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+
+#define MAP_SHARED  0x1  // writes reach the file and other mappings
+#define MAP_PRIVATE 0x2  // writes go to a private copy
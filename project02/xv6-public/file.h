@@ -14,6 +14,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // in icache's list in use or its LRU list
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
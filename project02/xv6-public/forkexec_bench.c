@@ -0,0 +1,89 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// fork()+exec()+wait() latency as the parent grows. With
+// copy-on-write fork the cost should barely depend on its size.
+
+#define ITERS  20
+#define MB     (1024*1024)
+
+int sizes[] = { 0, 4, 16, 32 };
+
+// Child and parent must still see their own writes after fork.
+int
+checkcow(char *buf, int n)
+{
+  int pid, i, fds[2];
+  char ok;
+
+  for(i = 0; i < n; i += 4096)
+    buf[i] = 'p';
+  pipe(fds);
+  pid = fork();
+  if(pid < 0)
+    return -1;
+  if(pid == 0){
+    ok = 1;
+    for(i = 0; i < n; i += 4096){
+      if(buf[i] != 'p')
+        ok = 0;
+      buf[i] = 'c';
+    }
+    write(fds[1], &ok, 1);
+    exit();
+  }
+  for(i = 0; i < n; i += 8192)
+    buf[i] = 'P';
+  read(fds[0], &ok, 1);
+  wait();
+  close(fds[0]);
+  close(fds[1]);
+  for(i = 0; i < n; i += 4096)
+    if(buf[i] != (i % 8192 ? 'p' : 'P'))
+      ok = 0;
+  return ok ? 0 : -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *args[] = { argv[0], "child", 0 };
+  char *mem;
+  int i, s, n, pid, start, cur;
+
+  if(argc > 1)
+    exit();  // we are the exec'd child
+
+  cur = 0;
+  for(s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++){
+    n = sizes[s]*MB - cur;
+    if(n > 0){
+      if((mem = sbrk(n)) == (char*)-1){
+        printf(1, "sbrk failed!\n");
+        exit();
+      }
+      for(i = 0; i < n; i += 4096)
+        mem[i] = 1;
+      if(checkcow(mem, n) < 0)
+        printf(1, "copy-on-write check failed!\n");
+      cur += n;
+    }
+    start = uptime();
+    for(i = 0; i < ITERS; i++){
+      if((pid = fork()) < 0){
+        printf(1, "fork failed!\n");
+        exit();
+      }
+      if(pid == 0){
+        exec(args[0], args);
+        printf(1, "exec failed!\n");
+        exit();
+      }
+      wait();
+    }
+    printf(1, "parent %d MB: %d fork+exec in %d ticks\n",
+           sizes[s], ITERS, uptime() - start);
+  }
+  exit();
+}
@@ -0,0 +1,134 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "memstat.h"
+
+// Processes grow and shrink their heaps at random, leaving holes,
+// while a thread samples the largest block of contiguous free
+// memory. Once they exit, freed pages should merge back into
+// blocks as large as the ones we started with.
+
+#define NCHILD   4
+#define ROUNDS   300
+#define MAXGROW  64   // pages
+
+volatile int done;
+uint seed;
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+int
+largest(void)
+{
+  struct memstat st;
+  int k;
+
+  memstat(&st);
+  for(k = NORDER-1; k >= 0; k--)
+    if(st.blocks[k] > 0)
+      return k;
+  return -1;
+}
+
+// Largest order once the per-CPU lists have given back their pages.
+// Without KTUNE they keep them, so this is only a lower bound.
+int
+drained(void)
+{
+  int k;
+
+  if(setkcache(KC_KSTACKS) < 0)
+    return largest();
+  k = largest();
+  setkcache(KC_ALL);
+  return k;
+}
+
+void
+churn(void)
+{
+  char *p;
+  int r, i, n, heap;
+
+  heap = 0;
+  for(r = 0; r < ROUNDS; r++){
+    n = 1 + rand() % MAXGROW;
+    p = sbrk(n*4096);
+    for(i = 0; i < n; i++)
+      if(rand() % 2)
+        p[i*4096] = r;
+    heap += n;
+    if(rand() % 3 == 0){
+      n = rand() % heap;
+      sbrk(-n*4096);
+      heap -= n;
+    }
+    if(rand() % 20 == 0){
+      if(fork() == 0){
+        for(i = 0; i < heap; i += 2)
+          p[-i*4096] = 0;
+        exit();
+      }
+      wait();
+    }
+  }
+}
+
+void*
+sampler(void *arg)
+{
+  struct memstat st;
+  int start, k;
+
+  start = uptime();
+  while(!done){
+    memstat(&st);
+    k = largest();
+    printf(1, "tick %d: %d free pages, largest block 2^%d pages\n",
+           uptime() - start, st.freepages, k);
+    sleep(10);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_t t;
+  void *retval;
+  int i, before, after;
+
+  before = drained();
+  printf(1, "before: largest block 2^%d pages\n", before);
+
+  if(thread_create(&t, sampler, 0) != 0){
+    printf(1, "thread_create failed!\n");
+    exit();
+  }
+  for(i = 0; i < NCHILD; i++){
+    if(fork() == 0){
+      seed = getpid();
+      churn();
+      exit();
+    }
+  }
+  for(i = 0; i < NCHILD; i++)
+    wait();
+  done = 1;
+  thread_join(t, &retval);
+
+  after = drained();
+  printf(1, "after: largest block 2^%d pages\n", after);
+  if(after >= before)
+    printf(1, "Test passed\n");
+  else
+    printf(1, "Test failed: free memory did not merge back\n");
+  exit();
+}
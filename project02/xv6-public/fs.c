@@ -119,12 +119,11 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to an inode cache entry (open
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref, and frees the entry when it reaches zero.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
@@ -154,8 +153,14 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
+// An inode whose last reference goes away stays cached on
+// icache.lru, most recently used first, so that opening it again
+// does not have to read the disk. Up to NILRU are kept; beyond
+// that, and whenever kalloc runs short, the least recently used
+// are freed.
+//
+// The icache.lock spin-lock protects the lists of icache
+// entries. Since ip->ref indicates whether an entry is in use,
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold icache.lock while using any of those fields.
 //
@@ -165,18 +170,58 @@ bfree(int dev, uint b)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct slabcache *cache;
+  struct inode *inode;         // entries in use
+  struct inode *lru;           // unreferenced entries, newest first
+  int nlru;
 } icache;
 
+#define IPERPG (PGSIZE / sizeof(struct inode))
+
+// Unlink and return the least recently used unreferenced entry,
+// or 0 if there is none. Caller holds icache.lock.
+static struct inode*
+ievict(void)
+{
+  struct inode *ip, **pp;
+
+  if(icache.lru == 0)
+    return 0;
+  for(pp = &icache.lru; (*pp)->next; pp = &(*pp)->next)
+    ;
+  ip = *pp;
+  *pp = 0;
+  icache.nlru--;
+  return ip;
+}
+
+// Shrinker callbacks. Inodes go back to the slab cache rather
+// than straight to kalloc, so the page counts are estimates.
+static int
+icount(void)
+{
+  return icache.nlru / IPERPG;
+}
+
+static int
+iscan(int n)
+{
+  struct inode *ip;
+  int freed;
+
+  acquire(&icache.lock);
+  for(freed = 0; freed < n*IPERPG && (ip = ievict()) != 0; freed++)
+    slabfree(ip);
+  release(&icache.lock);
+  return freed / IPERPG;
+}
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = slabcreate("inode", sizeof(struct inode));
+  regshrinker("inode", icount, iscan);
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
@@ -197,6 +242,7 @@ ialloc(uint dev, short type)
   int inum;
   struct buf *bp;
   struct dinode *dip;
+  struct inode *ip;
 
   for(inum = 1; inum < sb.ninodes; inum++){
     bp = bread(dev, IBLOCK(inum, sb));
@@ -206,11 +252,20 @@ ialloc(uint dev, short type)
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
-      return iget(dev, inum);
+      if((ip = iget(dev, inum)) == 0){
+        // Out of memory: give the disk inode back.
+        bp = bread(dev, IBLOCK(inum, sb));
+        dip = (struct dinode*)bp->data + inum%IPB;
+        dip->type = 0;
+        log_write(bp);
+        brelse(bp);
+      }
+      return ip;
     }
     brelse(bp);
   }
-  panic("ialloc: no inodes");
+  cprintf("[ialloc] no inodes!\n");
+  return 0;
 }
 
 // Copy a modified in-memory inode to disk.
@@ -235,33 +290,66 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+// Look for a cached entry for inode inum on device dev and
+// take a reference to it. Caller holds icache.lock.
+static struct inode*
+ifind(uint dev, uint inum)
+{
+  struct inode *ip, **pp;
+
+  for(ip = icache.inode; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      ip->ref++;
+      return ip;
+    }
+  }
+  for(pp = &icache.lru; (ip = *pp) != 0; pp = &ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      *pp = ip->next;
+      icache.nlru--;
+      ip->next = icache.inode;
+      icache.inode = ip;
+      ip->ref = 1;
+      return ip;
+    }
+  }
+  return 0;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// Returns 0 if there is no memory for a new entry.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, *new;
 
   acquire(&icache.lock);
+  ip = ifind(dev, inum);
+  release(&icache.lock);
+  if(ip)
+    return ip;
 
-  // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&icache.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  // Make a new cache entry. slaballoc may run the inode
+  // shrinker, so icache.lock cannot be held across it.
+  new = slaballoc(icache.cache);
+  acquire(&icache.lock);
+  if((ip = ifind(dev, inum)) != 0){
+    release(&icache.lock);
+    if(new)
+      slabfree(new);
+    return ip;
   }
-
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  if(new == 0 && (new = ievict()) == 0){
+    release(&icache.lock);
+    cprintf("[iget] no inodes!\n");
+    return 0;
+  }
+  ip = new;
+  initsleeplock(&ip->lock, "inode");
+  ip->next = icache.inode;
+  icache.inode = ip;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
@@ -322,8 +410,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry moves
+// to the LRU list.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -331,6 +419,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct inode **pp, *victim;
+
   acquiresleep(&ip->lock);
   if(ip->valid && ip->nlink == 0){
     acquire(&icache.lock);
@@ -346,9 +436,20 @@ iput(struct inode *ip)
   }
   releasesleep(&ip->lock);
 
+  victim = 0;
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    for(pp = &icache.inode; *pp != ip; pp = &(*pp)->next)
+      ;
+    *pp = ip->next;
+    ip->next = icache.lru;
+    icache.lru = ip;
+    if(++icache.nlru > NILRU)
+      victim = ievict();
+  }
   release(&icache.lock);
+  if(victim)
+    slabfree(victim);
 }
 
 // Common idiom: unlock, then put.
@@ -432,6 +533,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pcinval(ip);
 }
 
 // Copy stat information from inode.
@@ -494,6 +596,8 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(n > 0)
+    pcwrite(ip, src, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -521,6 +625,7 @@ namecmp(const char *s, const char *t)
 
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Returns 0 if not found or if iget fails.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
@@ -551,23 +656,24 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  int off, empty;
   struct dirent de;
-  struct inode *ip;
 
-  // Check that name is not present.
-  if((ip = dirlookup(dp, name, 0)) != 0){
-    iput(ip);
-    return -1;
-  }
-
-  // Look for an empty dirent.
+  // Check that name is not present and look for an empty
+  // dirent. Not through dirlookup: iget can fail when memory
+  // is short, which would look like the name was free.
+  empty = -1;
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlink read");
-    if(de.inum == 0)
-      break;
+    if(de.inum == 0){
+      if(empty < 0)
+        empty = off;
+    } else if(namecmp(name, de.name) == 0)
+      return -1;
   }
+  if(empty >= 0)
+    off = empty;
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
@@ -626,9 +732,10 @@ namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
 
-  if(*path == '/')
-    ip = iget(ROOTDEV, ROOTINO);
-  else
+  if(*path == '/'){
+    if((ip = iget(ROOTDEV, ROOTINO)) == 0)
+      return 0;
+  } else
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
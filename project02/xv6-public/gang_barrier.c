@@ -0,0 +1,89 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Barrier-synchronized workers that spin while waiting for peers.
+// Without gang scheduling a descheduled peer makes the others spin
+// away their time slices. Run with CPUS=4 and CPUS=8 to compare.
+
+#define MAXTHREAD 16
+#define ROUNDS    300
+#define WORK      20000
+
+thread_t thread[MAXTHREAD];
+int nthread;
+volatile int count;
+volatile int sense;
+volatile int sink;
+
+void
+barrier(int *local)
+{
+  *local = !*local;
+  if(__sync_add_and_fetch(&count, 1) == nthread){
+    count = 0;
+    sense = *local;
+  } else {
+    while(sense != *local)
+      ;
+  }
+}
+
+void *
+worker(void *arg)
+{
+  int i, j, local = 0;
+
+  for(i = 0; i < ROUNDS; i++){
+    for(j = 0; j < WORK; j++)
+      sink += j;
+    barrier(&local);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+int
+run(int gang)
+{
+  int i, start;
+  void *retval;
+
+  if(setgang(getpid(), gang) < 0){
+    printf(1, "setgang failed!\n");
+    exit();
+  }
+  count = 0;
+  sense = 0;
+  start = uptime();
+  for(i = 0; i < nthread; i++){
+    if(thread_create(&thread[i], worker, 0) != 0){
+      printf(1, "thread_create failed!\n");
+      exit();
+    }
+  }
+  for(i = 0; i < nthread; i++)
+    thread_join(thread[i], &retval);
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int off, on;
+
+  nthread = 4;
+  if(argc > 1)
+    nthread = atoi(argv[1]);
+  if(nthread < 1 || nthread > MAXTHREAD){
+    printf(1, "usage: gang_barrier [nthread <= %d]\n", MAXTHREAD);
+    exit();
+  }
+
+  printf(1, "gang_barrier: %d threads, %d rounds\n", nthread, ROUNDS);
+  off = run(0);
+  printf(1, "gang off: %d ticks\n", off);
+  on = run(1);
+  printf(1, "gang on:  %d ticks\n", on);
+  exit();
+}
@@ -0,0 +1,53 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "memstat.h"
+
+// The kernel should use all the RAM the BIOS reports, not just the
+// first 224MB. Run under QEMU with -m 512: a child touches 300MB
+// and checks that every page kept what it wrote.
+
+#define MB     (1024*1024)
+#define HOG    (300*MB)
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat st;
+  char *p;
+  int i, fds[2];
+  char ok;
+
+  memstat(&st);
+  printf(1, "%d MB free\n", st.freepages / (MB/4096));
+
+  pipe(fds);
+  if(fork() == 0){
+    close(fds[0]);
+    if((p = sbrk(HOG)) == (char*)-1){
+      printf(1, "sbrk failed!\n");
+      exit();
+    }
+    for(i = 0; i < HOG; i += 4096){
+      *(int*)(p + i) = i;
+      if(i % (32*MB) == 0)
+        printf(1, "touched %d MB\n", i / MB);
+    }
+    ok = 1;
+    for(i = 0; i < HOG; i += 4096)
+      if(*(int*)(p + i) != i)
+        ok = 0;
+    write(fds[1], &ok, 1);
+    exit();
+  }
+  close(fds[1]);
+  ok = 0;
+  read(fds[0], &ok, 1);
+  wait();
+  if(ok)
+    printf(1, "Test passed: %d MB in one process\n", HOG / MB);
+  else
+    printf(1, "Test failed: child killed or memory corrupted\n");
+  exit();
+}
@@ -0,0 +1,60 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+// Random reads and writes over a 64MB array, with the heap in
+// 4KB pages and then in 4MB pages. 16384 small pages are far more
+// than the TLB holds; 16 big ones are not.
+
+#define MB      (1024*1024)
+#define SIZE    (64*MB)
+#define HUGE    (4*MB)
+#define ACCESS  (1024*1024)
+
+void
+run(int huge)
+{
+  uint *a, seed, t, fill, rnd, sum;
+  char *p;
+  int i;
+
+  sethugeheap(huge);
+  if((p = sbrk(SIZE + HUGE)) == (char*)-1){
+    printf(1, "sbrk failed!\n");
+    exit();
+  }
+  a = (uint*)(((uint)p + HUGE-1) & ~(HUGE-1));
+
+  t = rdtsc();
+  for(i = 0; i < SIZE/4; i += 1024)
+    a[i] = i;
+  fill = rdtsc() - t;
+
+  seed = 1;
+  sum = 0;
+  t = rdtsc();
+  for(i = 0; i < ACCESS; i++){
+    seed = seed * 1103515245 + 12345;
+    sum += a[(seed >> 4) % (SIZE/4)]++;
+  }
+  rnd = rdtsc() - t;
+
+  printf(1, "%s pages: first touch %d Kcycles, %d cycles/access (%d)\n",
+         huge ? "4MB" : "4KB", fill / 1000, rnd / ACCESS, sum & 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int huge;
+
+  for(huge = 0; huge < 2; huge++){
+    if(fork() == 0){
+      run(huge);
+      exit();
+    }
+    wait();
+  }
+  exit();
+}
@@ -1,6 +1,11 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, or with kallocn
+// blocks of 2^n physically contiguous pages.
+//
+// Free memory is kept by a buddy allocator: a free block of 2^k
+// pages starts at a multiple of 2^k pages, and when both halves
+// of a block of 2^(k+1) pages are free they are merged.
 
 #include "types.h"
 #include "defs.h"
@@ -8,6 +13,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "memstat.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -15,32 +21,166 @@ extern char end[]; // first address after kernel loaded from ELF file
 
 struct run {
   struct run *next;
+  struct run *prev;            // only on the buddy lists
+};
+
+// Each CPU keeps a few free pages of its own so that most
+// allocations and frees do not touch the global list. Pages move
+// between a CPU's list and the global one KBATCH at a time.
+// A CPU with nothing to run also zeroes up to KZERO free pages
+// ahead of time for kzalloc.
+struct kcache {
+  struct spinlock lock;        // only contended when another CPU steals
+  struct run *freelist;
+  int nfree;
+  struct run *zerolist;        // free pages already zeroed
+  int nzero;
+};
+
+// A cache that can give back pages it holds but does not need.
+// count says how many it could give back; scan frees up to n of
+// them and says how many it did. kalloc calls them when it runs
+// out, so they must neither sleep nor allocate memory.
+struct shrinker {
+  char *name;
+  int (*count)(void);
+  int (*scan)(int);
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  int use_cache;               // use the per-CPU lists
+  struct run *freelist[NORDER];  // free blocks of 2^k pages
+  uint nblock[NORDER];
+  uint nfree;                  // pages on freelist
+  struct kcache cpu[NCPU];
+  uint nacquire;               // acquisitions of lock
+  uint nzerohit;               // kzalloc calls served from a zerolist
+  uint nzeromiss;              // kzalloc calls that zeroed a page
+  struct shrinker shrinker[NSHRINKER];
+  int nshrinker;
+  uint nreclaimed;             // pages the shrinkers gave back
+  ushort *ref;                 // references to each allocated page
+  uchar *order;                // 1+k if a free 2^k block starts here
 } kmem;
 
+// An entry of the BIOS memory map that bootasm.S leaves at E820MAP.
+struct e820 {
+  uint addr, addrhi;
+  uint len, lenhi;
+  uint type;
+};
+
+#define E820MAX  32
+#define E820RAM  1             // type of usable memory
+
+uint phystop;                  // end of the highest usable RAM
+char *zeropg;                  // page of zeros shared by all, never freed
+
+// Usable RAM below phystop.
+static struct {
+  uint start;
+  uint end;
+} ram[E820MAX];
+static int nram;
+
+#define PFN(v)  (V2P(v) / PGSIZE)
+#define REF(v)  (kmem.ref[PFN(v)])
+
+// Read the memory map to find the usable RAM the kernel can map.
+// Without a map, e.g. when not booted by bootasm.S, assume the
+// RAM from 0 to PHYSTOP.
+static void
+meminit(void)
+{
+  uint *n, start, end;
+  struct e820 *e;
+
+  n = P2V(E820MAP);
+  e = (struct e820*)(n + 1);
+  if(*n == 0 || *n > E820MAX){
+    ram[0].end = phystop = PHYSTOP;
+    nram = 1;
+    return;
+  }
+  for(; e < (struct e820*)(n + 1) + *n; e++){
+    if(e->type != E820RAM || e->addrhi || e->addr >= DEVSPACE - KERNBASE)
+      continue;
+    end = e->addr + e->len;
+    if(e->lenhi || end < e->addr || end > DEVSPACE - KERNBASE)
+      end = DEVSPACE - KERNBASE;
+    start = PGROUNDUP(e->addr);
+    end = PGROUNDDOWN(end);
+    if(start >= end)
+      continue;
+    ram[nram].start = start;
+    ram[nram].end = end;
+    nram++;
+    if(end > phystop)
+      phystop = end;
+  }
+}
+
+// Free the pages of [vstart, vend) that the memory map says
+// are usable RAM.
+static void
+freeram(char *vstart, char *vend)
+{
+  int i;
+  char *s, *e;
+
+  for(i = 0; i < nram; i++){
+    s = P2V(ram[i].start);
+    e = P2V(ram[i].end);
+    if(s < vstart)
+      s = vstart;
+    if(e > vend)
+      e = vend;
+    if(s < e)
+      freerange(s, e);
+  }
+}
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// The page counts and buddy orders for all of physical memory
+// take the first pages after the kernel.
 void
 kinit1(void *vstart, void *vend)
 {
+  uint npage;
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.cpu[i].lock, "kcache");
   kmem.use_lock = 0;
-  freerange(vstart, vend);
+  kmem.use_cache = 1;
+
+  meminit();
+  npage = phystop / PGSIZE;
+  kmem.ref = vstart;
+  kmem.order = (uchar*)(kmem.ref + npage);
+  vstart = kmem.order + npage;
+  if(vstart > vend)
+    panic("kinit1");
+  memset(kmem.ref, 0, (char*)vstart - (char*)kmem.ref);
+  freeram(vstart, vend);
 }
 
 void
 kinit2(void *vstart, void *vend)
 {
-  freerange(vstart, vend);
+  freeram(vstart, vend);
   kmem.use_lock = 1;
+  if((zeropg = kzalloc()) == 0)
+    panic("kinit2");
+  // Seen as shared by everyone, so it is always copied on write.
+  REF(zeropg) = 2;
 }
 
 void
@@ -48,49 +188,551 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    REF(p) = 1;
     kfree(p);
+  }
+}
+static void
+blink(struct run *r, int k)
+{
+  kmem.order[PFN(r)] = k + 1;
+  kmem.nblock[k]++;
+  r->prev = 0;
+  r->next = kmem.freelist[k];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[k] = r;
+}
+
+static void
+bunlink(struct run *r, int k)
+{
+  kmem.order[PFN(r)] = 0;
+  kmem.nblock[k]--;
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[k] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+}
+
+// Take a block of 2^k pages off the buddy lists, splitting a
+// bigger one if need be. Caller holds kmem.lock.
+static struct run*
+buddyalloc(int k)
+{
+  struct run *r;
+  int j;
+
+  for(j = k; j < NORDER && kmem.freelist[j] == 0; j++)
+    ;
+  if(j == NORDER)
+    return 0;
+  r = kmem.freelist[j];
+  bunlink(r, j);
+  // Give back the upper halves we do not need.
+  while(j > k){
+    j--;
+    blink((struct run*)((char*)r + (PGSIZE << j)), j);
+  }
+  kmem.nfree -= 1 << k;
+  return r;
+}
+
+// Put the block of 2^k pages at r on the buddy lists, merging it
+// with its buddy for as long as the buddy is free as well.
+// Caller holds kmem.lock.
+static void
+buddyfree(struct run *r, int k)
+{
+  uint pfn, buddy;
+
+  kmem.nfree += 1 << k;
+  pfn = PFN(r);
+  for(; k < NORDER-1; k++){
+    buddy = pfn ^ (1 << k);
+    if(buddy >= phystop/PGSIZE || kmem.order[buddy] != k + 1)
+      break;
+    bunlink((struct run*)P2V(buddy * PGSIZE), k);
+    pfn &= ~(1 << k);
+  }
+  blink((struct run*)P2V(pfn * PGSIZE), k);
+}
+
+// Move up to n pages from the global list to kc.
+// Caller holds kc->lock.
+static void
+refill(struct kcache *kc, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  kmem.nacquire++;
+  for(; n > 0 && (r = buddyalloc(0)) != 0; n--){
+    r->next = kc->freelist;
+    kc->freelist = r;
+    kc->nfree++;
+  }
+  release(&kmem.lock);
+}
+
+// Move up to n pages from kc back to the global list.
+// Caller holds kc->lock.
+static void
+spill(struct kcache *kc, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  kmem.nacquire++;
+  for(; n > 0 && (r = kc->freelist) != 0; n--){
+    kc->freelist = r->next;
+    kc->nfree--;
+    buddyfree(r, 0);
+  }
+  release(&kmem.lock);
 }
+
+// Take a page from some other CPU's list, for when both ours
+// and the global list are empty. Caller must not hold any
+// kcache lock, or two CPUs stealing from each other could deadlock.
+static struct run*
+steal(struct kcache *kc)
+{
+  struct kcache *victim;
+  struct run *r;
+
+  for(victim = kmem.cpu; victim < &kmem.cpu[NCPU]; victim++){
+    if(victim == kc || (victim->nfree == 0 && victim->nzero == 0))
+      continue;
+    acquire(&victim->lock);
+    if((r = victim->freelist) != 0){
+      victim->freelist = r->next;
+      victim->nfree--;
+    } else if((r = victim->zerolist) != 0){
+      victim->zerolist = r->next;
+      victim->nzero--;
+    }
+    release(&victim->lock);
+    if(r)
+      return r;
+  }
+  return 0;
+}
+
+// Return every page on the per-CPU lists to the global list,
+// where they can merge into bigger blocks.
+static void
+drain(void)
+{
+  struct kcache *kc;
+  struct run *r;
+
+  for(kc = kmem.cpu; kc < &kmem.cpu[NCPU]; kc++){
+    acquire(&kc->lock);
+    while((r = kc->zerolist) != 0){
+      kc->zerolist = r->next;
+      r->next = kc->freelist;
+      kc->freelist = r;
+      kc->nfree++;
+    }
+    kc->nzero = 0;
+    spill(kc, kc->nfree);
+    release(&kc->lock);
+  }
+}
+
+// Put a page straight on the global list.
+static void
+freepage(struct run *r)
+{
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  kmem.nacquire++;
+  buddyfree(r, 0);
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
+// Drop a reference to the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when the last reference goes away.
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *kc;
 
-  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
     panic("kfree");
+  if(v == zeropg)
+    return;
+  if(REF(v) == 0)
+    panic("kfree: free page");
+  if(__sync_sub_and_fetch(&REF(v), 1) != 0)
+    return;
 
   // Fill with junk to catch dangling refs.
-  memset(v, 1, PGSIZE);
+  if(KJUNK)
+    memset(v, 1, PGSIZE);
+
+  r = (struct run*)v;
+  if(kmem.use_lock && kmem.use_cache){
+    pushcli();
+    kc = &kmem.cpu[cpuid()];
+    acquire(&kc->lock);
+    // setkcache may have turned the lists off and drained kc
+    // since use_cache was read; then the page must not go on it.
+    if(kmem.use_cache){
+      r->next = kc->freelist;
+      kc->freelist = r;
+      if(++kc->nfree > 2*KBATCH)
+        spill(kc, KBATCH);
+      r = 0;
+    }
+    release(&kc->lock);
+    popcli();
+    if(r == 0)
+      return;
+  }
+  freepage(r);
+}
+
+// Take a free page from this CPU's lists, the global list or
+// another CPU's lists, in that order.
+static struct run*
+allocpage(void)
+{
+  struct run *r;
+  struct kcache *kc;
 
+  r = 0;
+  if(kmem.use_lock && kmem.use_cache){
+    pushcli();
+    kc = &kmem.cpu[cpuid()];
+    acquire(&kc->lock);
+    // Refilling kc after setkcache drained it would strand pages.
+    if(kmem.use_cache && kc->freelist == 0)
+      refill(kc, KBATCH);
+    r = kc->freelist;
+    if(r){
+      kc->freelist = r->next;
+      kc->nfree--;
+    } else if((r = kc->zerolist) != 0){
+      kc->zerolist = r->next;
+      kc->nzero--;
+    }
+    release(&kc->lock);
+    if(r == 0)
+      r = steal(kc);
+    popcli();
+    if(r)
+      return r;
+  }
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  kmem.nacquire++;
+  r = buddyalloc(0);
   if(kmem.use_lock)
     release(&kmem.lock);
+  return r;
+}
+
+// Ask the shrinkers for up to n pages. Returns how many they freed.
+static int
+shrink(int n)
+{
+  struct shrinker *s;
+  int freed;
+
+  freed = 0;
+  for(s = kmem.shrinker; s < &kmem.shrinker[kmem.nshrinker] && freed < n; s++)
+    freed += s->scan(n - freed);
+  __sync_fetch_and_add(&kmem.nreclaimed, freed);
+  return freed;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
-// Returns 0 if the memory cannot be allocated.
+// Returns 0 if the memory cannot be allocated, even after the
+// shrinkers have given back what they can.
 char*
 kalloc(void)
 {
   struct run *r;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  if((r = allocpage()) == 0 && kmem.use_lock && shrink(KBATCH) > 0)
+    r = allocpage();
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+    REF(r) = 1;
+  return (char*)r;
+}
+
+// Take a block of 2^order pages from the buddy lists.
+static struct run*
+allocblock(int order)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  kmem.nacquire++;
+  r = buddyalloc(order);
+  release(&kmem.lock);
+  return r;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. Returns 0 if there is no such block free, even
+// after the per-CPU lists give theirs back. Single pages should
+// come from kalloc, which is faster.
+//
+// Pages the shrinkers free are scattered, so they seldom make a
+// large block; only for blocks up to 2^KSHRINKORDER pages are
+// the shrinkers asked, a batch at a time until one turns up.
+char*
+kallocn(int order)
+{
+  struct run *r;
+  int i, freed;
+
+  if(order < 0 || order >= NORDER)
+    return 0;
+  r = allocblock(order);
+  if(r == 0 && kmem.use_cache){
+    drain();
+    r = allocblock(order);
+  }
+  for(freed = 0; r == 0 && order <= KSHRINKORDER && freed < (KBATCH << order); ){
+    if((i = shrink(KBATCH)) == 0)
+      break;
+    freed += i;
+    if(kmem.use_cache)
+      drain();
+    r = allocblock(order);
+  }
+  if(r)
+    for(i = 0; i < (1 << order); i++)
+      REF((char*)r + i*PGSIZE) = 1;
+  return (char*)r;
+}
+
+// Free a block from kallocn(order). Unlike kfree, the caller
+// must hold the only reference to each of its pages.
+void
+kfreen(char *v, int order)
+{
+  int i;
+
+  if(order < 0 || order >= NORDER || (uint)v % (PGSIZE << order) ||
+     v < end || V2P(v) + (PGSIZE << order) > phystop)
+    panic("kfreen");
+  for(i = 0; i < (1 << order); i++){
+    if(REF(v + i*PGSIZE) != 1)
+      panic("kfreen: shared page");
+    REF(v + i*PGSIZE) = 0;
+  }
+  if(KJUNK)
+    memset(v, 1, PGSIZE << order);
+
+  acquire(&kmem.lock);
+  kmem.nacquire++;
+  buddyfree((struct run*)v, order);
+  release(&kmem.lock);
+}
+
+// Allocate a page filled with zeros, taking it from this CPU's
+// zerolist when there is one ready.
+char*
+kzalloc(void)
+{
+  struct run *r;
+  struct kcache *kc;
+
+  r = 0;
+  if(kmem.use_lock && kmem.use_cache){
+    pushcli();
+    kc = &kmem.cpu[cpuid()];
+    acquire(&kc->lock);
+    if((r = kc->zerolist) != 0){
+      kc->zerolist = r->next;
+      kc->nzero--;
+    }
+    release(&kc->lock);
+    popcli();
+  }
+  if(r){
+    r->next = 0;
+    REF(r) = 1;
+    __sync_fetch_and_add(&kmem.nzerohit, 1);
+    return (char*)r;
+  }
+  if((r = (struct run*)kalloc()) == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+  __sync_fetch_and_add(&kmem.nzeromiss, 1);
   return (char*)r;
 }
 
+// Zero a few free pages onto this CPU's zerolist. Called by the
+// scheduler when it finds nothing to run, with interrupts on;
+// it stops after KBATCH pages so that a process woken meanwhile
+// does not wait long.
+void
+kzerofill(void)
+{
+  struct kcache *kc;
+  struct run *r;
+  int i;
+
+  if(!kmem.use_lock || !kmem.use_cache)
+    return;
+  // The scheduler never moves to another CPU, so kc stays ours
+  // with interrupts enabled.
+  pushcli();
+  kc = &kmem.cpu[cpuid()];
+  popcli();
+  for(i = 0; i < KBATCH && kc->nzero < KZERO; i++){
+    acquire(&kc->lock);
+    if(!kmem.use_cache){
+      release(&kc->lock);
+      break;
+    }
+    if(kc->freelist == 0)
+      refill(kc, KBATCH);
+    if((r = kc->freelist) != 0){
+      kc->freelist = r->next;
+      kc->nfree--;
+    }
+    release(&kc->lock);
+    if(r == 0)
+      break;
+
+    // No one else can see r while it is being zeroed.
+    memset(r, 0, PGSIZE);
+
+    acquire(&kc->lock);
+    if(kmem.use_cache){
+      r->next = kc->zerolist;
+      kc->zerolist = r;
+      kc->nzero++;
+      r = 0;
+    }
+    release(&kc->lock);
+    if(r){
+      freepage(r);
+      break;
+    }
+  }
+}
+
+// Take another reference to an allocated page, e.g. when a
+// copy-on-write fork maps it into a second page table.
+void
+kincref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop || REF(v) == 0)
+    panic("kincref");
+  if(v == zeropg)
+    return;
+  __sync_fetch_and_add(&REF(v), 1);
+}
+
+// Number of references to an allocated page.
+int
+krefcount(char *v)
+{
+  return REF(v);
+}
+
+
+// Turn the caches named by flags (KC_PAGES for the per-CPU free
+// lists, KC_KSTACKS for the kernel stack cache) on and the others
+// off. Turning the lists off returns their pages to the global
+// list. Everything that puts pages on a list checks use_cache
+// again with the list's lock held, so none can arrive after
+// drain() has emptied it.
+int
+setkcache(int flags)
+{
+  kmem.use_cache = (flags & KC_PAGES) != 0;
+  if(!kmem.use_cache)
+    drain();
+  kstackcache((flags & KC_KSTACKS) != 0);
+  return 0;
+}
+
+// Register a shrinker. Done once per cache, at boot.
+void
+regshrinker(char *name, int (*count)(void), int (*scan)(int))
+{
+  if(kmem.nshrinker == NSHRINKER)
+    panic("regshrinker");
+  kmem.shrinker[kmem.nshrinker].name = name;
+  kmem.shrinker[kmem.nshrinker].count = count;
+  kmem.shrinker[kmem.nshrinker].scan = scan;
+  kmem.nshrinker++;
+}
+
+// Free pages, counting the per-CPU lists. Racy, but only a guide.
+static uint
+nfreepages(void)
+{
+  struct kcache *kc;
+  uint n;
+
+  n = kmem.nfree;
+  for(kc = kmem.cpu; kc < &kmem.cpu[NCPU]; kc++)
+    n += kc->nfree + kc->nzero;
+  return n;
+}
+
+// The reclaim daemon, a kernel process. Once a tick it checks
+// whether free memory is below KLOWATER pages, and if so has the
+// shrinkers give back pages, and then pages out user pages, until
+// KHIWATER are free. Faults then seldom have to wait for swap.
+void
+reclaimd(void)
+{
+  for(;;){
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+    if(nfreepages() >= KLOWATER)
+      continue;
+    while(nfreepages() < KHIWATER)
+      if(shrink(KBATCH) == 0 && pageout() < 0)
+        break;
+  }
+}
+
+// Report free memory and allocator lock statistics.
+void
+kmemstat(struct memstat *st)
+{
+  struct kcache *kc;
+  struct shrinker *s;
+  int i;
+
+  st->cpupages = 0;
+  st->zeropages = 0;
+  for(kc = kmem.cpu; kc < &kmem.cpu[NCPU]; kc++){
+    st->cpupages += kc->nfree;
+    st->zeropages += kc->nzero;
+  }
+  st->freepages = kmem.nfree + st->cpupages + st->zeropages;
+  st->cachedpages = 0;
+  for(s = kmem.shrinker; s < &kmem.shrinker[kmem.nshrinker]; s++)
+    st->cachedpages += s->count();
+  st->reclaimed = kmem.nreclaimed;
+  st->kmemacquire = kmem.nacquire;
+  st->kmemspin = kmem.lock.nspin;
+  st->zerohit = kmem.nzerohit;
+  for(i = 0; i < NORDER; i++)
+    st->blocks[i] = kmem.nblock[i];
+  st->zeromiss = kmem.nzeromiss;
+}
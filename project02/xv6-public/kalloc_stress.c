@@ -0,0 +1,76 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "memstat.h"
+
+// Several processes allocating and freeing pages at once, first
+// with every page going through the global free list and then
+// with per-CPU free lists. Run with CPUS=8 to see the contention.
+
+#define PAGES   64
+#define ROUNDS  200
+#define FORKS   20
+
+void
+churn(void)
+{
+  char *p;
+  int i, r;
+
+  for(r = 0; r < ROUNDS; r++){
+    p = sbrk(PAGES*4096);
+    for(i = 0; i < PAGES; i++)
+      p[i*4096] = r;
+    sbrk(-PAGES*4096);
+    if(r % (ROUNDS/FORKS) == 0){
+      if(fork() == 0)
+        exit();
+      wait();
+    }
+  }
+}
+
+void
+run(int nproc, int percpu)
+{
+  struct memstat before, after;
+  int i, start;
+
+  setkcache(percpu ? KC_ALL : KC_KSTACKS);
+  memstat(&before);
+  start = uptime();
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0){
+      churn();
+      exit();
+    }
+  }
+  for(i = 0; i < nproc; i++)
+    wait();
+  memstat(&after);
+  printf(1, "%s: %d ticks, %d lock acquisitions, %d spins\n",
+         percpu ? "per-CPU lists" : "global list  ",
+         uptime() - start,
+         after.kmemacquire - before.kmemacquire,
+         after.kmemspin - before.kmemspin);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc;
+
+  nproc = 8;
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  printf(1, "kalloc_stress: %d processes x %d rounds of %d pages\n",
+         nproc, ROUNDS, PAGES);
+  // Without KTUNE only the default, per-CPU lists on, can be run.
+  if(setkcache(KC_ALL) < 0)
+    printf(1, "kernel built without KTUNE=1: per-CPU lists stay on\n");
+  else
+    run(nproc, 0);
+  run(nproc, 1);
+  exit();
+}
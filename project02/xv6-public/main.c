@@ -26,14 +26,20 @@ main(void)
   ioapicinit();    // another interrupt controller
   consoleinit();   // console hardware
   uartinit();      // serial port
-  pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  shminit();       // shared memory
+  swapinit();      // swap space
+  slabinit();      // kernel object caches
+  pcinit();        // page cache
+  pinit();         // process table
   fileinit();      // file table
+  pipeinit();      // pipes
   ideinit();       // disk 
   startothers();   // start other processors
-  kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  kinit2(P2V(4*1024*1024), P2V(phystop)); // must come after startothers()
   userinit();      // first user process
+  kproc("reclaimd", reclaimd);  // keeps memory free
   mpmain();        // finish this processor's setup
 }
 
@@ -0,0 +1,107 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// The memory limit counts the pages a process has resident,
+// whichever of its threads touched them.
+
+#define LIMIT    (1024*1024)
+#define NTHREAD  4
+#define PGSIZE   4096
+
+char *heap;
+int pages;
+
+void*
+toucher(void *arg)
+{
+  int i;
+  char *p = heap + (int)arg * pages * PGSIZE;
+
+  for(i = 0; i < pages; i++)
+    p[i*PGSIZE] = 1;
+  thread_exit(0);
+  return 0;
+}
+
+// In a child limited to LIMIT bytes, have NTHREAD threads touch
+// n pages each. Returns 1 if the child survived.
+int
+run(int n)
+{
+  thread_t t[NTHREAD];
+  void *ret;
+  int i, fds[2];
+  char ok;
+
+  pipe(fds);
+  if(fork() == 0){
+    close(fds[0]);
+    if(setmemorylimit(getpid(), LIMIT) < 0){
+      printf(1, "setmemorylimit failed!\n");
+      exit();
+    }
+    pages = n;
+    heap = sbrk(NTHREAD * n * PGSIZE);
+    for(i = 0; i < NTHREAD; i++)
+      thread_create(&t[i], toucher, (void*)i);
+    for(i = 0; i < NTHREAD; i++)
+      thread_join(t[i], &ret);
+    ok = 1;
+    write(fds[1], &ok, 1);
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &ok, 1) != 1)
+    ok = 0;
+  close(fds[0]);
+  wait();
+  return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, fds[2];
+  char *p, ok;
+
+  // 4 x 40 pages plus the program fit in 256 pages.
+  if(run(40))
+    printf(1, "Test 1 passed\n");
+  else
+    printf(1, "Test 1 failed: killed under the limit\n");
+
+  // 4 x 80 pages do not.
+  if(!run(80))
+    printf(1, "Test 2 passed\n");
+  else
+    printf(1, "Test 2 failed: limit not enforced across threads\n");
+
+  // A forked child is charged for the pages it shares with its
+  // parent, so writing all of them never exceeds the limit.
+  pipe(fds);
+  if(fork() == 0){
+    close(fds[0]);
+    setmemorylimit(getpid(), LIMIT);
+    p = sbrk(128 * PGSIZE);
+    for(i = 0; i < 128; i++)
+      p[i*PGSIZE] = 1;
+    if(fork() == 0){
+      for(i = 0; i < 128; i++)
+        p[i*PGSIZE] = 2;
+      ok = 1;
+      write(fds[1], &ok, 1);
+      exit();
+    }
+    wait();
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &ok, 1) == 1)
+    printf(1, "Test 3 passed\n");
+  else
+    printf(1, "Test 3 failed: copy-on-write hit the limit\n");
+  close(fds[0]);
+  wait();
+  exit();
+}
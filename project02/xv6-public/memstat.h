@@ -0,0 +1,21 @@
+// Caches setkcache can turn off, for benchmarks.
+#define KC_PAGES    1   // per-CPU free page lists
+#define KC_KSTACKS  2   // kernel stacks of freed procs
+#define KC_ALL      (KC_PAGES|KC_KSTACKS)
+
+// Physical memory statistics, filled in by the memstat system call.
+struct memstat {
+  uint freepages;     // Free pages, including the per-CPU lists
+  uint cpupages;      // Free pages held on per-CPU lists
+  uint kmemacquire;   // Acquisitions of the global free list lock
+  uint kmemspin;      // Spins waiting for the global free list lock
+  uint zeropages;     // Free pages zeroed ahead of time by idle CPUs
+  uint zerohit;       // Zeroed allocations served from those pages
+  uint zeromiss;      // Zeroed allocations that had to zero a page
+  uint blocks[NORDER];  // Free blocks of 2^k contiguous pages
+  uint swapslots;     // Pages the swap area holds
+  uint swapused;      // Swap slots in use
+  uint swapouts;      // Pages written to swap
+  uint cachedpages;   // Pages held by caches that could give them back
+  uint reclaimed;     // Pages caches have given back under pressure
+};
@@ -0,0 +1,116 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "x86.h"
+
+// Counts the lines and words of a file, wc-style, through read()
+// and through mmap(), then checks that MAP_SHARED writes reach the
+// file and MAP_PRIVATE ones do not.
+
+#define FSIZE   (64*1024)
+#define ROUNDS  50
+
+char buf[4096];
+
+void
+count(char *p, int n, int *lines, int *words)
+{
+  int i, inword;
+
+  inword = 0;
+  for(i = 0; i < n; i++){
+    if(p[i] == '\n')
+      (*lines)++;
+    if(p[i] == ' ' || p[i] == '\n')
+      inword = 0;
+    else if(!inword){
+      (*words)++;
+      inword = 1;
+    }
+  }
+}
+
+void
+mkfile(char *name)
+{
+  int fd, i, j;
+
+  if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+    printf(1, "open %s failed!\n", name);
+    exit();
+  }
+  for(i = 0; i < FSIZE; i += sizeof(buf)){
+    for(j = 0; j < sizeof(buf); j++)
+      buf[j] = (i + j) % 61 == 0 ? '\n' : (i + j) % 7 == 0 ? ' ' : 'a' + j % 26;
+    write(fd, buf, sizeof(buf));
+  }
+  close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, r, n, lines[2], words[2], ok;
+  uint t[2];
+  char *p;
+
+  mkfile("mmapfile");
+
+  lines[0] = words[0] = 0;
+  t[0] = rdtsc();
+  for(r = 0; r < ROUNDS; r++){
+    fd = open("mmapfile", O_RDONLY);
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      count(buf, n, &lines[0], &words[0]);
+    close(fd);
+  }
+  t[0] = rdtsc() - t[0];
+
+  lines[1] = words[1] = 0;
+  t[1] = rdtsc();
+  for(r = 0; r < ROUNDS; r++){
+    fd = open("mmapfile", O_RDONLY);
+    if((p = mmap(fd, 0, FSIZE, MAP_SHARED)) == (char*)-1){
+      printf(1, "mmap failed!\n");
+      exit();
+    }
+    close(fd);
+    count(p, FSIZE, &lines[1], &words[1]);
+    munmap(p);
+  }
+  t[1] = rdtsc() - t[1];
+
+  printf(1, "read: %d lines %d words, %d Kcycles/pass\n", lines[0], words[0], t[0] / ROUNDS / 1000);
+  printf(1, "mmap: %d lines %d words, %d Kcycles/pass\n", lines[1], words[1], t[1] / ROUNDS / 1000);
+  ok = lines[0] == lines[1] && words[0] == words[1];
+
+  // A shared write from a child, seen by read() after munmap; a
+  // private write, not seen.
+  if(fork() == 0){
+    fd = open("mmapfile", O_RDWR);
+    p = mmap(fd, 0, FSIZE, MAP_SHARED);
+    p[FSIZE-1] = 'S';
+    munmap(p);
+    p = mmap(fd, 0, FSIZE, MAP_PRIVATE);
+    p[0] = 'P';
+    munmap(p);
+    close(fd);
+    exit();
+  }
+  wait();
+  fd = open("mmapfile", O_RDONLY);
+  for(r = 0; (n = read(fd, buf, sizeof(buf))) > 0; r += n)
+    if(r == 0 && buf[0] == 'P')
+      ok = 0;
+  close(fd);
+  if(buf[sizeof(buf)-1] != 'S')
+    ok = 0;
+  unlink("mmapfile");
+
+  if(ok)
+    printf(1, "Test passed\n");
+  else
+    printf(1, "Test failed\n");
+  exit();
+}
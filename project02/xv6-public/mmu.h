@@ -83,6 +83,7 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define HUGESZ          0x400000  // bytes mapped by a 4MB page (PTE_PS)
 
 #define PTXSHIFT        12      // offset of PTX in a linear address
 #define PDXSHIFT        22      // offset of PDX in a linear address
@@ -94,11 +95,23 @@ struct segdesc {
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_A           0x020   // Accessed
+#define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_COW         0x200   // Copy-on-write (available to software)
+#define PTE_GUARD       0x400   // Guard gap, set only with PTE_P clear
+#define PTE_SHM         0x800   // Shared memory, stays shared across fork
+#define PTE_SWAP        0x100   // Swapped out, set only with PTE_P clear
+
+// Page fault error code bits (tf->err for T_PGFLT).
+#define FEC_PR          0x1     // Protection violation, else not present
+#define FEC_WR          0x2     // Caused by a write
+#define FEC_U           0x4     // Happened in user mode
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
 #define PTE_FLAGS(pte)  ((uint)(pte) &  0xFFF)
+#define PTE_SLOT(pte)   ((uint)(pte) >> PTXSHIFT)  // swap slot if PTE_SWAP
 
 #ifndef __ASSEMBLER__
 typedef uint pte_t;
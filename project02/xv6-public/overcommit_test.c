@@ -0,0 +1,58 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "memstat.h"
+
+// Children together touch 16MB more than there is free memory,
+// then check that every page kept what they wrote. Without swap
+// the last of them are killed for want of memory.
+
+#define NCHILD  4
+#define EXTRA   (16*1024*1024/4096)
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat st;
+  int i, j, n, pass, fds[2], good;
+  char *p, ok;
+
+  memstat(&st);
+  n = (st.freepages + EXTRA) / NCHILD;
+  printf(1, "%d pages free, %d swap slots; %d children touch %d pages each\n",
+         st.freepages, st.swapslots, NCHILD, n);
+
+  pipe(fds);
+  for(i = 0; i < NCHILD; i++){
+    if(fork() == 0){
+      close(fds[0]);
+      ok = 0;
+      if((p = sbrk(n*4096)) != (char*)-1){
+        for(j = 0; j < n; j++)
+          *(int*)(p + j*4096) = j ^ i;
+        ok = 1;
+        for(pass = 0; pass < 2; pass++)
+          for(j = 0; j < n; j++)
+            if(*(int*)(p + j*4096) != (j ^ i))
+              ok = 0;
+      }
+      write(fds[1], &ok, 1);
+      exit();
+    }
+  }
+  close(fds[1]);
+  good = 0;
+  for(i = 0; i < NCHILD; i++)
+    if(read(fds[0], &ok, 1) == 1 && ok)
+      good++;
+  memstat(&st);
+  for(i = 0; i < NCHILD; i++)
+    wait();
+
+  if(good == NCHILD)
+    printf(1, "Test passed: %d swap slots in use at the end\n", st.swapused);
+  else
+    printf(1, "Test failed: %d of %d children finished\n", good, NCHILD);
+  exit();
+}
@@ -1,14 +1,36 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC      4096  // maximum number of processes and threads
+#define NPIDHASH    256  // buckets in the pid and tid hash tables
 #define KSTACKSIZE 4096  // size of per-process kernel stack
+#define NKSTACK      16  // freed kernel stacks kept for reuse
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define FSSIZE       4000  // size of file system in blocks
+#define FAIRDECAY     100  // ticks between halvings of CPU usage
+#define NFUTEX        64  // futex wait channels
 
+#define NPCHASH      64  // buckets in the page cache hash table
+#define NSEG          4  // loadable program segments per process
+#define KBATCH       32  // pages moved to or from a CPU's free list at once
+#define KZERO        256  // pre-zeroed pages each CPU keeps while idle
+#define KJUNK        0  // 1: fill freed pages with junk to catch dangling refs
+#ifndef KTUNE
+#define KTUNE        0  // 1 (make KTUNE=1): let benchmarks switch kernel caches off
+#endif
+#define NSLAB        16  // maximum number of slab caches
+#define NORDER       11  // kallocn block sizes, 2^0 to 2^10 pages
+#define KSHRINKORDER  3  // largest kallocn order worth shrinking caches for
+#define NSHM         16  // shared memory segments in the system
+#define NSHMMAP       4  // shared memory segments attached per process
+#define SHMMAXPG   1024  // most pages in a shared memory segment
+#define NMMAP         8  // file mappings per process
+#define SWAPSIZE  65536  // blocks of swap space after the file system
+#define NILRU        64  // unreferenced inodes kept in the inode cache
+#define NSHRINKER     4  // caches kalloc can ask to give back memory
+#define KLOWATER    256  // free pages below which reclaimd starts
+#define KHIWATER    512  // free pages at which reclaimd stops
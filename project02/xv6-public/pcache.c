@@ -0,0 +1,298 @@
+// Page cache.
+//
+// The page cache holds whole pages of file contents so that
+// processes mapping the same part of the same file, such as the
+// text of a program that is running more than once, can share
+// one physical page instead of each reading its own copy.
+//
+// Interface:
+// * To get the page holding file bytes [off, off+PGSIZE), call
+//   pcget. It returns the page with a reference for the caller,
+//   who maps it and drops it with kfree.
+// * writei calls pcwrite to copy new data into cached pages, so
+//   that every mapping of them sees it. itrunc calls pcinval.
+// * Pages of a shared mapping are written by the process itself;
+//   pcsync writes such a page back to the file.
+// * Under memory pressure kalloc has the cache give back pages
+//   that no process maps.
+//
+// The cache owns one reference to each page it holds, so a page
+// stays allocated while either the cache or a process uses it.
+// A page that some process still maps is never evicted: evicting
+// it would free nothing, and a shared mapping relies on finding
+// it again. Pages are identified by device, inode number and file
+// offset, not by struct inode, which is recycled by the inode cache.
+//
+// The cache has no fixed size; it grows until kalloc runs short
+// and asks for pages back. All pages of one file hash to the same
+// chain, so pcwrite and pcinval only look at that file's pages.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint off;
+  char *mem;
+  struct cpage *hnext;         // in hash chain, or free list
+  struct cpage *prev;          // in LRU list
+  struct cpage *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct slabcache *cache;
+  struct cpage *hash[NPCHASH];
+  struct cpage *lru;           // most recently used first
+  struct cpage *lrutail;
+  struct cpage *free;          // unused entries
+} pcache;
+
+static struct cpage**
+pchash(uint dev, uint inum)
+{
+  return &pcache.hash[(dev * 31 + inum) % NPCHASH];
+}
+
+// Move c to the front of the LRU list. Caller holds pcache.lock.
+static void
+pcuse(struct cpage *c)
+{
+  if(pcache.lru == c)
+    return;
+  if(c->prev)
+    c->prev->next = c->next;
+  if(c->next)
+    c->next->prev = c->prev;
+  if(pcache.lrutail == c)
+    pcache.lrutail = c->prev;
+  c->prev = 0;
+  c->next = pcache.lru;
+  if(pcache.lru)
+    pcache.lru->prev = c;
+  pcache.lru = c;
+  if(pcache.lrutail == 0)
+    pcache.lrutail = c;
+}
+
+// Drop the cache's reference to c's page and put c on the free
+// list. Caller holds pcache.lock. Entries are not given back to
+// the slab cache: the shrinker runs inside kalloc, possibly under
+// this cache's slab lock.
+static void
+pcdrop(struct cpage *c)
+{
+  struct cpage **pp;
+
+  for(pp = pchash(c->dev, c->inum); *pp != c; pp = &(*pp)->hnext)
+    ;
+  *pp = c->hnext;
+  if(c->prev)
+    c->prev->next = c->next;
+  else
+    pcache.lru = c->next;
+  if(c->next)
+    c->next->prev = c->prev;
+  else
+    pcache.lrutail = c->prev;
+  kfree(c->mem);
+  c->mem = 0;
+  c->hnext = pcache.free;
+  pcache.free = c;
+}
+
+// Shrinker callbacks. Only pages that no process maps can go,
+// least recently used first.
+static int
+pccount(void)
+{
+  struct cpage *c;
+  int n;
+
+  n = 0;
+  acquire(&pcache.lock);
+  for(c = pcache.lru; c; c = c->next)
+    if(krefcount(c->mem) == 1)
+      n++;
+  release(&pcache.lock);
+  return n;
+}
+
+static int
+pcscan(int n)
+{
+  struct cpage *c, *prev;
+  int freed;
+
+  freed = 0;
+  acquire(&pcache.lock);
+  for(c = pcache.lrutail; c && freed < n; c = prev){
+    prev = c->prev;
+    if(krefcount(c->mem) == 1){
+      pcdrop(c);
+      freed++;
+    }
+  }
+  release(&pcache.lock);
+  return freed;
+}
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.cache = slabcreate("pcache", sizeof(struct cpage));
+  regshrinker("pcache", pccount, pcscan);
+}
+
+// Return the page of ip's contents starting at off, reading it
+// from disk if it is not cached. The page must start within the
+// file; any part past the end is zero. Caller must hold ip->lock.
+// Returns 0 if out of memory; the page is never handed out
+// uncached, since a shared mapping must find it again.
+char*
+pcget(struct inode *ip, uint off)
+{
+  struct cpage *c;
+  char *mem;
+  uint n;
+
+  acquire(&pcache.lock);
+  for(c = *pchash(ip->dev, ip->inum); c; c = c->hnext){
+    if(c->dev == ip->dev && c->inum == ip->inum && c->off == off){
+      pcuse(c);
+      kincref(c->mem);
+      release(&pcache.lock);
+      return c->mem;
+    }
+  }
+  if((c = pcache.free) != 0)
+    pcache.free = c->hnext;
+  release(&pcache.lock);
+
+  // slaballoc may run the shrinker, so pcache.lock cannot be
+  // held across it.
+  if(c == 0 && (c = slaballoc(pcache.cache)) == 0)
+    return 0;
+
+  // Holding ip->lock means no one else can be filling this page.
+  n = ip->size - off;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  if((mem = (n < PGSIZE ? kzalloc() : kalloc())) == 0)
+    goto bad;
+  if(readi(ip, mem, off, n) != n){
+    kfree(mem);
+    goto bad;
+  }
+
+  acquire(&pcache.lock);
+  c->dev = ip->dev;
+  c->inum = ip->inum;
+  c->off = off;
+  c->mem = mem;
+  c->hnext = *pchash(ip->dev, ip->inum);
+  *pchash(ip->dev, ip->inum) = c;
+  c->prev = c->next = 0;
+  pcuse(c);
+  kincref(mem);
+  release(&pcache.lock);
+  return mem;
+
+bad:
+  acquire(&pcache.lock);
+  c->hnext = pcache.free;
+  pcache.free = c;
+  release(&pcache.lock);
+  return 0;
+}
+
+// Forget every cached page of ip.
+void
+pcinval(struct inode *ip)
+{
+  struct cpage *c, *next;
+
+  acquire(&pcache.lock);
+  for(c = *pchash(ip->dev, ip->inum); c; c = next){
+    next = c->hnext;
+    if(c->dev == ip->dev && c->inum == ip->inum)
+      pcdrop(c);
+  }
+  release(&pcache.lock);
+}
+
+// Copy the n bytes at src, which writei is writing to ip at off,
+// into any cached pages they fall in. Caller must hold ip->lock.
+void
+pcwrite(struct inode *ip, char *src, uint off, uint n)
+{
+  struct cpage *c;
+  char *mem;
+  uint lo, hi, coff, next;
+
+  // src may be user memory, which must not be touched with
+  // pcache.lock held. Each page is held by a reference instead
+  // while it is written; the caller's inode lock keeps others
+  // from filling pages of ip meanwhile. Pages are done in order
+  // of offset, since the chain may change while unlocked.
+  for(next = 0;;){
+    acquire(&pcache.lock);
+    mem = 0;
+    coff = 0;
+    for(c = *pchash(ip->dev, ip->inum); c; c = c->hnext){
+      if(c->dev == ip->dev && c->inum == ip->inum &&
+         c->off >= next && c->off < off + n &&
+         off < c->off + PGSIZE && (mem == 0 || c->off < coff)){
+        mem = c->mem;
+        coff = c->off;
+      }
+    }
+    if(mem)
+      kincref(mem);
+    release(&pcache.lock);
+    if(mem == 0)
+      break;
+    next = coff + 1;
+    lo = coff > off ? coff : off;
+    hi = coff + PGSIZE < off + n ? coff + PGSIZE : off + n;
+    if(mem + (lo - coff) != src + (lo - off))
+      memmove(mem + (lo - coff), src + (lo - off), hi - lo);
+    kfree(mem);
+  }
+}
+
+// Write the page mem of a shared mapping back to ip at off, up
+// to the end of the file. A page is more than one transaction
+// may log, so it goes in pieces.
+void
+pcsync(struct inode *ip, uint off, char *mem)
+{
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint i, n;
+
+  for(i = 0; i < PGSIZE; i += n){
+    begin_op();
+    ilock(ip);
+    n = 0;
+    if(off + i < ip->size){
+      n = ip->size - (off + i);
+      if(n > PGSIZE - i)
+        n = PGSIZE - i;
+      if(n > max)
+        n = max;
+      writei(ip, mem + i, off + i, n);
+    }
+    iunlock(ip);
+    end_op();
+    if(n == 0)
+      break;
+  }
+}
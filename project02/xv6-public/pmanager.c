@@ -79,13 +79,13 @@ main(void)
         argv[0] = path;
         argv[1] = 0;
 
+        // The program runs in the background. It is spawned from a
+        // short-lived child, so that it becomes init's when that
+        // exits and init reaps it rather than pmanager.
         int pid = fork();
         if(pid == 0){
-            pid = fork();
-            if(pid == 0){
-                if(exec2(path, argv, stacksize) < 0){
-                  printf(1, "execute failed!\n");
-                }
+            if(spawn(path, argv, stacksize, 0) < 0){
+                printf(1, "execute failed!\n");
             }
             exit();
         }
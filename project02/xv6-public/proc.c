@@ -9,8 +9,33 @@
 
 struct {
   struct spinlock lock;
-  struct proc proc[NPROC];
-} ptable;
+  struct slabcache *cache;     // where procs come from
+  struct proc *list;           // every proc, newest first
+  int nproc;                   // procs on list
+  struct proc *runq;           // RUNNABLE procs, oldest first
+  struct proc *runqtail;
+  int nrunq;
+  struct proc *pidhash[NPIDHASH];  // main threads by pid
+  struct proc *tidhash[NPIDHASH];  // other threads by tid
+  int gangpid;                 // Gang being co-scheduled, or 0
+  uint gangtick;               // Tick in which gangpid was chosen
+  int procfair;                // Share CPU per process, not per thread
+  struct proc *fairheap[NPROC];  // Main threads with a RUNNABLE thread
+  int nfair;
+  uint fairseq;
+  char futex[NFUTEX];          // Futex wait channels
+  struct proc *hand;           // Process pageout() is sweeping
+  uint handva;                 // Where in it pageout() is
+} ptable = { .procfair = 1 };
+
+// Kernel stacks of freed procs, so that allocproc seldom has to
+// call kalloc. kalloc takes them back when memory runs low.
+struct {
+  struct spinlock lock;
+  char *stack[NKSTACK];
+  int n;
+  int off;                     // turned off by setkcache
+} kstacks;
 
 struct spinlock sbrklock;
 
@@ -24,11 +49,286 @@ extern void trapret(void);
 static void wakeup1(void *chan);
 void alignedPrint(int temp, int count);
 
+static int
+kstackcount(void)
+{
+  return kstacks.n;
+}
+
+static int
+kstackscan(int n)
+{
+  int freed;
+
+  acquire(&kstacks.lock);
+  for(freed = 0; freed < n && kstacks.n > 0; freed++)
+    kfree(kstacks.stack[--kstacks.n]);
+  release(&kstacks.lock);
+  return freed;
+}
+
+static char*
+kstackget(void)
+{
+  char *s;
+
+  acquire(&kstacks.lock);
+  s = kstacks.n > 0 ? kstacks.stack[--kstacks.n] : 0;
+  release(&kstacks.lock);
+  if(s == 0)
+    s = kalloc();
+  return s;
+}
+
+static void
+kstackput(char *s)
+{
+  acquire(&kstacks.lock);
+  if(kstacks.n < NKSTACK && !kstacks.off){
+    kstacks.stack[kstacks.n++] = s;
+    s = 0;
+  }
+  release(&kstacks.lock);
+  if(s)
+    kfree(s);
+}
+
+// Turn the kernel stack cache on or off, for benchmarks.
+void
+kstackcache(int enable)
+{
+  acquire(&kstacks.lock);
+  kstacks.off = !enable;
+  release(&kstacks.lock);
+  if(!enable)
+    kstackscan(NKSTACK);
+}
+
 void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
   initlock(&sbrklock, "sbrklock");
+  initlock(&kstacks.lock, "kstacks");
+  ptable.cache = slabcreate("proc", sizeof(struct proc));
+  regshrinker("kstacks", kstackcount, kstackscan);
+}
+
+// The process table. Procs are allocated as they are needed, up
+// to NPROC, and all of them are on ptable.list. Main threads are
+// found by pid in pidhash and other threads by tid in tidhash, so
+// looking one up does not mean walking the whole list. The
+// scheduler only looks at ptable.runq, which holds the RUNNABLE
+// procs in the order they became runnable, and at ptable.fairheap,
+// which holds the thread groups that have a RUNNABLE thread, least
+// CPU usage first. Each group keeps its RUNNABLE threads on the
+// main thread's grq. The ptable lock must be held for all of these.
+
+static struct proc**
+hashchain(struct proc *p)
+{
+  if(p->tid > 0)
+    return &ptable.tidhash[p->tid % NPIDHASH];
+  return &ptable.pidhash[p->pid % NPIDHASH];
+}
+
+static void
+hashproc(struct proc *p)
+{
+  struct proc **pp;
+
+  pp = hashchain(p);
+  p->hnext = *pp;
+  *pp = p;
+}
+
+static void
+unhashproc(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = hashchain(p); *pp != p; pp = &(*pp)->hnext)
+    ;
+  *pp = p->hnext;
+}
+
+// Find the main thread of process pid.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  for(p = ptable.pidhash[pid % NPIDHASH]; p; p = p->hnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
+}
+
+// Find the thread with the given tid.
+static struct proc*
+findthread(thread_t tid)
+{
+  struct proc *p;
+
+  for(p = ptable.tidhash[tid % NPIDHASH]; p; p = p->hnext)
+    if(p->tid == tid)
+      return p;
+  return 0;
+}
+
+// CPU usage of thread group g. It is halved every FAIRDECAY ticks,
+// which is done only when it is looked at.
+static uint
+fairusage(struct proc *g)
+{
+  uint n;
+
+  n = ticks / FAIRDECAY - g->fairepoch;
+  if(n > 0){
+    g->gcputicks = n < 32 ? g->gcputicks >> n : 0;
+    g->fairepoch += n;
+  }
+  return g->gcputicks;
+}
+
+// Whether group a goes before b: less usage, or the same usage and
+// waiting longer. Halving keeps usages in order, so the heap does
+// not need fixing when they decay.
+static int
+fairless(struct proc *a, struct proc *b)
+{
+  uint ua, ub;
+
+  ua = fairusage(a);
+  ub = fairusage(b);
+  if(ua != ub)
+    return ua < ub;
+  return (int)(a->fairseq - b->fairseq) < 0;
+}
+
+static void
+fairset(int i, struct proc *g)
+{
+  ptable.fairheap[i] = g;
+  g->fairidx = i + 1;
+}
+
+// Move g up or down ptable.fairheap to where it belongs.
+static void
+fairfix(struct proc *g)
+{
+  struct proc **h = ptable.fairheap;
+  int i, c;
+
+  i = g->fairidx - 1;
+  while(i > 0 && fairless(g, h[(i-1)/2])){
+    fairset(i, h[(i-1)/2]);
+    i = (i-1)/2;
+  }
+  for(;;){
+    c = 2*i + 1;
+    if(c >= ptable.nfair)
+      break;
+    if(c+1 < ptable.nfair && fairless(h[c+1], h[c]))
+      c++;
+    if(!fairless(h[c], g))
+      break;
+    fairset(i, h[c]);
+    i = c;
+  }
+  fairset(i, g);
+}
+
+// Make p RUNNABLE and put it at the end of the run queue and of
+// its group's queue.
+static void
+setrunnable(struct proc *p)
+{
+  struct proc *g = p->main;
+
+  p->state = RUNNABLE;
+  p->rqnext = 0;
+  p->rqprev = ptable.runqtail;
+  if(ptable.runqtail)
+    ptable.runqtail->rqnext = p;
+  else
+    ptable.runq = p;
+  ptable.runqtail = p;
+  ptable.nrunq++;
+
+  p->grnext = 0;
+  p->grprev = g->grqtail;
+  if(g->grqtail)
+    g->grqtail->grnext = p;
+  else
+    g->grq = p;
+  g->grqtail = p;
+  if(g->fairidx == 0){
+    g->fairseq = ptable.fairseq++;
+    fairset(ptable.nfair++, g);
+    fairfix(g);
+  }
+}
+
+static void
+runqremove(struct proc *p)
+{
+  struct proc *g = p->main;
+  struct proc *last;
+
+  if(p->rqprev)
+    p->rqprev->rqnext = p->rqnext;
+  else
+    ptable.runq = p->rqnext;
+  if(p->rqnext)
+    p->rqnext->rqprev = p->rqprev;
+  else
+    ptable.runqtail = p->rqprev;
+  ptable.nrunq--;
+
+  if(p->grprev)
+    p->grprev->grnext = p->grnext;
+  else
+    g->grq = p->grnext;
+  if(p->grnext)
+    p->grnext->grprev = p->grprev;
+  else
+    g->grqtail = p->grprev;
+  if(g->grq){
+    // The group goes behind the others with the same usage.
+    g->fairseq = ptable.fairseq++;
+    fairfix(g);
+  } else {
+    last = ptable.fairheap[--ptable.nfair];
+    if(last != g){
+      fairset(g->fairidx - 1, last);
+      fairfix(last);
+    }
+    g->fairidx = 0;
+  }
+}
+
+// Take p out of the process table, keep its kernel stack for the
+// next allocproc and free it. Caller holds ptable.lock.
+static void
+freeproc(struct proc *p)
+{
+  if(p->state == RUNNABLE)
+    runqremove(p);
+  unhashproc(p);
+  if(p->prev)
+    p->prev->next = p->next;
+  else
+    ptable.list = p->next;
+  if(p->next)
+    p->next->prev = p->prev;
+  if(ptable.hand == p){
+    ptable.hand = p->next;
+    ptable.handva = 0;
+  }
+  ptable.nproc--;
+  kstackput(p->kstack);
+  slabfree(p);
 }
 
 // Must be called with interrupts disabled
@@ -71,37 +371,53 @@ myproc(void) {
 }
 
 //PAGEBREAK: 32
-// Look in the process table for an UNUSED proc.
-// If found, change state to EMBRYO and initialize
-// state required to run in the kernel.
-// Otherwise return 0.
+// Allocate a proc and a kernel stack for it and add it to the
+// process table. If there is room, change state to EMBRYO and
+// initialize state required to run in the kernel.
+// Otherwise return 0. If main is set, the proc is a thread of main:
+// it shares main's pid and takes a tid instead of a new pid.
 static struct proc*
-allocproc(void)
+allocproc(struct proc *main)
 {
   struct proc *p;
   char *sp;
 
-  acquire(&ptable.lock);
+  if((p = slaballoc(ptable.cache)) == 0)
+    return 0;
+  memset(p, 0, sizeof(*p));
+  // Allocate kernel stack.
+  if((p->kstack = kstackget()) == 0){
+    slabfree(p);
+    return 0;
+  }
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
+  acquire(&ptable.lock);
 
-  release(&ptable.lock);
-  return 0;
+  if(ptable.nproc == NPROC){
+    release(&ptable.lock);
+    kstackput(p->kstack);
+    slabfree(p);
+    return 0;
+  }
 
-found:
   p->state = EMBRYO;
-  p->pid = nextpid++;
-  p->main = p;
+  if(main){
+    p->pid = main->pid;
+    p->tid = nexttid++;
+    p->main = main;
+  } else {
+    p->pid = nextpid++;
+    p->main = p;
+  }
+  p->next = ptable.list;
+  if(ptable.list)
+    ptable.list->prev = p;
+  ptable.list = p;
+  ptable.nproc++;
+  hashproc(p);
 
   release(&ptable.lock);
 
-  // Allocate kernel stack.
-  if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
-    return 0;
-  }
   sp = p->kstack + KSTACKSIZE;
 
   // Leave room for trap frame.
@@ -129,13 +445,14 @@ userinit(void)
   struct proc *p;
   extern char _binary_initcode_start[], _binary_initcode_size[];
 
-  p = allocproc();
+  p = allocproc(0);
   
   initproc = p;
   if((p->pgdir = setupkvm()) == 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
   p->sz = PGSIZE;
+  p->rss = 1;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -154,12 +471,48 @@ userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&ptable.lock);
 }
 
+// Is any shared memory or file mapped in main at or above va?
+static int
+mapabove(struct proc *main, uint va)
+{
+  struct shmmap *m;
+  struct vmseg *s;
+
+  for(m = main->shm; m < &main->shm[NSHMMAP]; m++)
+    if(m->seg && m->va + m->sz > va)
+      return 1;
+  for(s = main->mmap; s < &main->mmap[NMMAP]; s++)
+    if(s->ip && s->va + s->memsz > va)
+      return 1;
+  return 0;
+}
+
+// Start a kernel process that runs fn, which must never return.
+// It has a page table with nothing but the kernel in it.
+void
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc(0)) == 0 || (p->pgdir = setupkvm()) == 0)
+    panic("kproc");
+  // forkret returns to fn instead of trapret.
+  *(uint*)(p->context + 1) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  setrunnable(p);
+  release(&ptable.lock);
+}
+
 // Grow current process's memory by n bytes.
+// Growing only reserves address space; pages are allocated
+// and zeroed by pagefault() when they are first touched.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -172,11 +525,18 @@ growproc(int n)
 
   sz = curproc->main->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->main->pgdir, sz, sz + n)) == 0)
+    if(sz + n < sz || sz + n >= KERNBASE){
+      release(&ptable.lock);
       return -1;
+    }
+    sz += n;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->main->pgdir, sz, sz + n)) == 0)
+    if(sz + n > sz || mapabove(curproc->main, sz + n)){
+      release(&ptable.lock);
       return -1;
+    }
+    unchargeuvm(curproc->main, countuvm(curproc->main->pgdir, sz + n, sz));
+    sz = deallocuvm(curproc->main->pgdir, sz, sz + n);
   }
   curproc->main->sz = sz;
   curproc->sz = sz;
@@ -203,23 +563,44 @@ fork(void)
   struct proc *curproc = myproc();
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
   acquire(&ptable.lock);
 
   // Copy process state from proc.
   if((np->pgdir = copyuvm(curproc->main->pgdir, curproc->main->sz)) == 0){
-    kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+    freeproc(np);
+    release(&ptable.lock);
     return -1;
   }
+  // Our writable pages just became copy-on-write, also for
+  // threads running on other CPUs.
+  tlbflush(curproc->pgdir);
   np->sz = curproc->main->sz;
+  np->rss = curproc->main->rss;
+  np->hugeheap = curproc->main->hugeheap;
+  for(i = 0; i < NSEG; i++){
+    np->seg[i] = curproc->main->seg[i];
+    if(np->seg[i].ip)
+      idup(np->seg[i].ip);
+  }
+  for(i = 0; i < NSHMMAP; i++){
+    np->shm[i] = curproc->main->shm[i];
+    if(np->shm[i].seg)
+      shmdup(np->shm[i].seg);
+  }
+  for(i = 0; i < NMMAP; i++){
+    np->mmap[i] = curproc->main->mmap[i];
+    if(np->mmap[i].ip)
+      idup(np->mmap[i].ip);
+  }
   np->parent = curproc;
   *np->tf = *curproc->tf;
-  np->stacksize = curproc->stacksize;
-  np->memlim = curproc->memlim;
+  np->stacksize = curproc->main->stacksize;
+  np->ustack = curproc->main->ustack;
+  np->memlim = curproc->main->memlim;
+  np->gang = curproc->main->gang;
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
@@ -235,13 +616,105 @@ fork(void)
 
   // acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  setrunnable(np);
 
   release(&ptable.lock);
 
   return pid;
 }
 
+// Create a child that runs the program path, as fork followed by
+// exec2 would, but without copying the caller's memory only to
+// throw it away. The child's descriptor i is the caller's
+// descriptor fdmap[i], or closed if that is -1 or not open; with
+// no fdmap the child gets the same descriptors as the caller.
+int
+spawn(char *path, char **argv, int stacksize, int *fdmap)
+{
+  int i, fd, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if(stacksize < 1 || stacksize > 100){
+    cprintf("[spawn] stacksize is out of range!\n");
+    return -1;
+  }
+
+  if((np = allocproc(0)) == 0){
+    return -1;
+  }
+  memset(np->tf, 0, sizeof(*np->tf));
+  np->tf->cs = (SEG_UCODE << 3) | DPL_USER;
+  np->tf->ds = (SEG_UDATA << 3) | DPL_USER;
+  np->tf->es = np->tf->ds;
+  np->tf->ss = np->tf->ds;
+  np->tf->eflags = FL_IF;
+  np->memlim = curproc->main->memlim;
+  np->gang = curproc->main->gang;
+
+  if(spawnimage(np, path, argv, stacksize) < 0){
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
+    return -1;
+  }
+
+  for(i = 0; i < NOFILE; i++){
+    fd = fdmap ? fdmap[i] : i;
+    if(fd >= 0 && fd < NOFILE && curproc->ofile[fd])
+      np->ofile[i] = filedup(curproc->ofile[fd]);
+  }
+  np->cwd = idup(curproc->cwd);
+  np->parent = curproc;
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  setrunnable(np);
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
+// Stop and free every other thread of curproc's process, which
+// makemain has marked as exiting. A thread may be anywhere in a
+// system call, perhaps holding sleep-locks or inside a file system
+// operation, so it is only killed and woken here. It leaves
+// through exit() at the user boundary, which sends it to
+// thread_exit(), and is freed once it is a zombie.
+static void
+reapthreads(struct proc *curproc)
+{
+  struct proc *p, *next;
+  int alive;
+
+  acquire(&ptable.lock);
+  for(;;){
+    alive = 0;
+    for(p = ptable.list; p; p = next){
+      next = p->next;
+      if(p->pid != curproc->pid || p == curproc)
+        continue;
+      if(p->state == ZOMBIE){
+        freeproc(p);
+        continue;
+      }
+      alive = 1;
+      p->killed = 1;
+      if(p->state == SLEEPING)
+        setrunnable(p);
+    }
+    if(!alive)
+      break;
+    // thread_exit() wakes the main thread.
+    sleep(curproc, &ptable.lock);
+  }
+  curproc->exiting = 0;
+  release(&ptable.lock);
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -255,21 +728,18 @@ exit(void)
   if(curproc == initproc)
     panic("init exiting");
 
-  // Exit all threads in the process
-  acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == curproc->pid && p != curproc){
-      kfree(p->kstack);
-      p->kstack = 0;
-      p->pid = 0;
-      p->tid = 0;
-      p->parent = 0;
-      p->name[0] = 0;
-      p->killed = 0;
-      p->state = UNUSED;
-    }
-  }
-  release(&ptable.lock);
+  // Exit all threads in the process first, so that none of them
+  // still uses the mappings and segments freed below. A thread
+  // takes the main thread's place so that it is not freed too,
+  // unless another thread's exit or exec is already stopping it.
+  if(makemain(curproc) < 0)
+    thread_exit(0);
+  reapthreads(curproc);
+
+  freesegs(curproc->main->seg);
+  shmexit(curproc->main->shm);
+  shmdisown(curproc->main);
+  freemaps(curproc->main->pgdir, curproc->main->mmap);
 
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
@@ -290,7 +760,7 @@ exit(void)
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.list; p; p = p->next){
     if(p->parent == curproc){
       p->parent = initproc;
       if(p->state == ZOMBIE)
@@ -317,21 +787,17 @@ wait(void)
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
+    for(p = ptable.list; p; p = p->next){
+      // Threads share their main thread's parent, but only the
+      // main thread is a child to wait for.
+      if(p->parent != curproc || p->tid > 0)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
         freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        freeproc(p);
         release(&ptable.lock);
         return pid;
       }
@@ -348,6 +814,46 @@ wait(void)
   }
 }
 
+// Gang scheduling. The first CPU to pick a thread of a process in
+// gang mode during a tick makes that process the active gang, and
+// until the next tick every CPU runs the gang's runnable threads
+// before anything else. Since all CPUs yield on the timer tick,
+// the gang's threads end up sharing the same time slice.
+// The ptable lock must be held.
+static struct proc*
+gangpick(struct proc *p)
+{
+  struct proc *q;
+
+  if(ptable.gangpid != 0 && ptable.gangtick == ticks){
+    if((q = findproc(ptable.gangpid)) != 0 && q->grq)
+      return q->grq;
+  }
+  if(p->main->gang){
+    ptable.gangpid = p->pid;
+    ptable.gangtick = ticks;
+  }
+  return p;
+}
+
+// Process-fair scheduling. Every timer tick a thread runs through
+// is charged to its main thread, which holds the usage of the whole
+// thread group. Pick the group that has used the least, from the
+// top of ptable.fairheap, and in it the thread that has been
+// runnable longest, so a process gets the same share however many
+// threads it has. Usage is halved every FAIRDECAY ticks so that a
+// process that slept for a while cannot monopolize the CPU once it
+// wakes up. Groups with the same usage take turns. Without
+// procfair, the run queue is plain round-robin over threads.
+// The ptable lock must be held.
+static struct proc*
+fairpick(void)
+{
+  if(!ptable.procfair)
+    return ptable.runq;
+  return ptable.fairheap[0]->grq;
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -361,17 +867,22 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int ran, n;
   c->proc = 0;
   
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
+    // Run as many processes from the run queue as were on it,
+    // then let interrupts in again.
+    ran = 0;
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
-        continue;
+    for(n = ptable.nrunq; n > 0 && ptable.runq; n--){
+      p = fairpick();
+      p = gangpick(p);
+      runqremove(p);
+      ran = 1;
 
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
@@ -381,14 +892,25 @@ scheduler(void)
       p->state = RUNNING;
 
       swtch(&(c->scheduler), p->context);
-      switchkvm();
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
+      // Keep its page table loaded in case the next pick is
+      // another thread of the same process.
       c->proc = 0;
     }
+
+    // A page table is only freed with ptable.lock held, so the
+    // last one used must be dropped before the lock is released.
+    if(c->pgdir){
+      c->pgdir = 0;
+      switchkvm();
+    }
     release(&ptable.lock);
 
+    // Nothing to run: spend the time zeroing pages for kzalloc.
+    if(!ran)
+      kzerofill();
   }
 }
 
@@ -418,12 +940,20 @@ sched(void)
   mycpu()->intena = intena;
 }
 
-// Give up the CPU for one scheduling round.
+// Give up the CPU for one scheduling round. Only the timer tick
+// yields, so the thread has used up a tick of CPU.
 void
 yield(void)
 {
+  struct proc *p = myproc();
+  struct proc *g = p->main;
+
   acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  fairusage(g);
+  g->gcputicks++;
+  if(g->fairidx)
+    fairfix(g);
+  setrunnable(p);
   sched();
   release(&ptable.lock);
 }
@@ -496,9 +1026,9 @@ wakeup1(void *chan)
 {
   struct proc *p;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for(p = ptable.list; p; p = p->next)
     if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+      setrunnable(p);
 }
 
 // Wake up all processes sleeping on chan.
@@ -519,44 +1049,92 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
+  if((p = findproc(pid)) == 0){
+    release(&ptable.lock);
+    return -1;
   }
+  p->killed = 1;
+  // Wake process from sleep if necessary.
+  if(p->state == SLEEPING)
+    setrunnable(p);
   release(&ptable.lock);
-  return -1;
+  return 0;
 }
 
+// Make curproc the main thread of its process, in place of the
+// old one if curproc is a thread, and mark the process as exiting
+// so that reapthreads can stop the others. Returns -1 if another
+// thread's exit or exec got there first; curproc has then been
+// killed and must leave through thread_exit().
 int
-exec_kill(int pid)
+makemain(struct proc *curproc)
 {
+  struct proc *main = curproc->main;
   struct proc *p;
 
-  // Exit all the threads
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid && p->tid > 0){
-      // Clear thread
-      kfree(p->kstack);
-      p->kstack = 0;
-      p->pid = 0;
-      p->tid = 0;
-      p->parent = 0;
-      p->name[0] = 0;
-      p->killed = 0;
-      p->state = UNUSED;
-    }
+  if(main->exiting){
+    release(&ptable.lock);
+    return -1;
+  }
+  if(curproc == main){
+    curproc->exiting = 1;
+    release(&ptable.lock);
+    return 0;
   }
+  unhashproc(main);
+  unhashproc(curproc);
+  memmove(curproc->seg, main->seg, sizeof(curproc->seg));
+  memset(main->seg, 0, sizeof(main->seg));
+  memmove(curproc->shm, main->shm, sizeof(curproc->shm));
+  memset(main->shm, 0, sizeof(main->shm));
+  memmove(curproc->mmap, main->mmap, sizeof(curproc->mmap));
+  memset(main->mmap, 0, sizeof(main->mmap));
+  curproc->sz = main->sz;
+  curproc->rss = main->rss;
+  curproc->hugeheap = main->hugeheap;
+  curproc->memlim = main->memlim;
+  curproc->gang = main->gang;
+  curproc->gcputicks = main->gcputicks;
+  curproc->fairepoch = main->fairepoch;
+  // Hand the old main thread's place in the scheduler over too.
+  curproc->grq = main->grq;
+  curproc->grqtail = main->grqtail;
+  curproc->fairseq = main->fairseq;
+  curproc->fairidx = main->fairidx;
+  if(curproc->fairidx)
+    fairset(curproc->fairidx - 1, curproc);
+  main->grq = main->grqtail = 0;
+  main->fairidx = 0;
+  main->tid = curproc->tid;
+  curproc->tid = 0;
+  curproc->parent = main->parent;
+  // The scheduler follows p->main, so none may point at the old
+  // main thread once reapthreads can free it.
+  for(p = ptable.list; p; p = p->next)
+    if(p->pid == curproc->pid)
+      p->main = curproc;
+  curproc->exiting = 1;
+  hashproc(main);
+  hashproc(curproc);
   release(&ptable.lock);
   return 0;
 }
 
+// Stop every other thread of the calling process, making the
+// caller the main thread. Returns -1 if another thread is already
+// doing so.
+int
+exec_kill(int pid)
+{
+  struct proc *curproc = myproc();
+
+  if(makemain(curproc) < 0)
+    return -1;
+  reapthreads(curproc);
+  return 0;
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -577,9 +1155,7 @@ procdump(void)
   char *state;
   uint pc[10];
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->state == UNUSED)
-      continue;
+  for(p = ptable.list; p; p = p->next){
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
@@ -599,7 +1175,6 @@ int
 setmemorylimit(int pid, int limit)
 {
   struct proc *p;
-  int pidCheck = 0;
 
   // Check if the value of limit is an integer greater than or equal to 0
   if(limit < 0){
@@ -608,37 +1183,345 @@ setmemorylimit(int pid, int limit)
   }
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      if(limit < p->main->sz){
-        cprintf("[setmemorylimit] limit is smaller than the previously allocated memory!\n");
-        return -1;
-      }
-      p->memlim = limit;
-      pidCheck = 1; // pid exists
+  if((p = findproc(pid)) == 0){
+    release(&ptable.lock);
+    cprintf("[setmemorylimit] pid doesn't exist!\n");
+    return -1;
+  }
+  // Only pages actually touched count as allocated.
+  if(limit > 0 && limit < p->rss * PGSIZE){
+    cprintf("[setmemorylimit] limit is smaller than the previously allocated memory!\n");
+    release(&ptable.lock);
+    return -1;
+  }
+  p->memlim = limit;
+  release(&ptable.lock);
+
+  return 0;
+}
+
+// Turns gang scheduling on or off for every thread of the process
+int
+setgang(int pid, int enable)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  if((p = findproc(pid)) == 0){
+    release(&ptable.lock);
+    cprintf("[setgang] pid doesn't exist!\n");
+    return -1;
+  }
+  p->gang = (enable != 0);
+  release(&ptable.lock);
+
+  return 0;
+}
+
+// Chooses whether CPU time is shared per process or per thread
+int
+setprocfair(int enable)
+{
+  acquire(&ptable.lock);
+  ptable.procfair = (enable != 0);
+  release(&ptable.lock);
+  return 0;
+}
+
+// Chooses whether the untouched heap of the calling process is
+// filled in with 4MB pages rather than 4KB ones.
+int
+sethugeheap(int enable)
+{
+  myproc()->main->hugeheap = (enable != 0);
+  return 0;
+}
+
+// Map shared memory segment id above the heap of the calling
+// process and return its address. The heap can grow past it
+// afterwards but not shrink below it.
+int
+shmattach(int id)
+{
+  struct proc *curproc = myproc();
+  struct proc *main = curproc->main;
+  struct shmmap *m;
+  struct shmseg *s;
+  uint va, sz;
+  int n, owned;
+
+  if((s = shmref(id)) == 0)
+    return -1;
+  n = shmpages(s);
+  owned = shmclaim(s, main->pid);
+  acquire(&ptable.lock);
+  for(m = main->shm; m < &main->shm[NSHMMAP]; m++)
+    if(m->seg == 0)
+      break;
+  va = PGROUNDUP(main->sz);
+  sz = va + n*PGSIZE;
+  if(m == &main->shm[NSHMMAP] || sz < va || sz >= KERNBASE)
+    goto bad;
+  if(!owned && chargeuvm(main, n) < 0)
+    goto bad;
+  if(shmuvm(s, main->pgdir, va) < 0){
+    deallocuvm(main->pgdir, sz, va);
+    if(!owned)
+      unchargeuvm(main, n);
+    goto bad;
+  }
+  m->seg = s;
+  m->va = va;
+  m->sz = n*PGSIZE;
+  main->sz = sz;
+  curproc->sz = sz;
+  release(&ptable.lock);
+  return va;
+
+bad:
+  release(&ptable.lock);
+  if(owned)
+    shmunclaim(s, main->pid);
+  shmput(s);
+  return -1;
+}
+
+// Unmap the shared memory segment attached at addr. A segment at
+// the top of the heap gives its space back; one lower down leaves
+// a hole of guard pages.
+int
+shmdetach(uint addr)
+{
+  struct proc *main = myproc()->main;
+  struct shmmap *m;
+  struct shmseg *s;
+  uint a;
+
+  acquire(&ptable.lock);
+  for(m = main->shm; m < &main->shm[NSHMMAP]; m++)
+    if(m->seg && m->va == addr)
+      break;
+  if(m == &main->shm[NSHMMAP]){
+    release(&ptable.lock);
+    return -1;
+  }
+  unchargeuvm(main, countuvm(main->pgdir, m->va, m->va + m->sz));
+  deallocuvm(main->pgdir, m->va + m->sz, m->va);
+  if(main->sz == m->va + m->sz){
+    main->sz = m->va;
+    myproc()->sz = m->va;
+  } else {
+    for(a = m->va; a < m->va + m->sz; a += PGSIZE)
+      guarduvm(main->pgdir, a);
+  }
+  s = m->seg;
+  m->seg = 0;
+  release(&ptable.lock);
+  shmput(s);
+  return 0;
+}
+
+// Map len bytes of ip from offset off above the heap of the
+// calling process and return the address. The mapping takes over
+// the caller's reference to ip. perm is PTE_SHM for a shared
+// mapping, with PTE_W if it is writable; a private one is always
+// writable. Only the part of the file that exists now is mapped;
+// any further pages are zero. Pages are read in when touched.
+int
+mapfile(struct inode *ip, uint off, uint len, uint filesz, int perm)
+{
+  struct proc *curproc = myproc();
+  struct proc *main = curproc->main;
+  struct vmseg *s;
+  uint va, sz;
+
+  acquire(&ptable.lock);
+  for(s = main->mmap; s < &main->mmap[NMMAP]; s++)
+    if(s->ip == 0)
+      break;
+  va = PGROUNDUP(main->sz);
+  sz = va + PGROUNDUP(len);
+  if(s == &main->mmap[NMMAP] || len == 0 || sz <= va || sz >= KERNBASE){
+    release(&ptable.lock);
+    return -1;
+  }
+  s->ip = ip;
+  s->va = va;
+  s->off = off;
+  s->filesz = filesz < len ? filesz : len;
+  s->memsz = sz - va;
+  s->perm = perm;
+  main->sz = sz;
+  curproc->sz = sz;
+  release(&ptable.lock);
+  return va;
+}
+
+// Unmap the file mapped at addr, writing back what was written to
+// it if it is shared. A mapping at the top of the heap gives its
+// space back; one lower down leaves a hole of guard pages.
+int
+unmapfile(uint addr)
+{
+  struct proc *main = myproc()->main;
+  struct vmseg *m, s;
+  uint a;
+
+  acquire(&ptable.lock);
+  for(m = main->mmap; m < &main->mmap[NMMAP]; m++)
+    if(m->ip && m->va == addr)
+      break;
+  if(m == &main->mmap[NMMAP]){
+    release(&ptable.lock);
+    return -1;
+  }
+  s = *m;
+  m->ip = 0;
+  release(&ptable.lock);
+
+  syncuvm(main->pgdir, &s);
+
+  acquire(&ptable.lock);
+  unchargeuvm(main, countuvm(main->pgdir, s.va, s.va + s.memsz));
+  deallocuvm(main->pgdir, s.va + s.memsz, s.va);
+  if(main->sz == s.va + s.memsz){
+    main->sz = s.va;
+    myproc()->sz = s.va;
+  } else if(main->sz > s.va + s.memsz) {
+    for(a = s.va; a < s.va + s.memsz; a += PGSIZE)
+      guarduvm(main->pgdir, a);
+  }
+  release(&ptable.lock);
+
+  begin_op();
+  iput(s.ip);
+  end_op();
+  return 0;
+}
+
+// Can pageout() take pages from p? The kernel never touches user
+// memory with a spinlock held, except through the kernel mapping
+// with ptable.lock held, so any live process will do.
+static int
+swappable(struct proc *p)
+{
+  return p->main == p && p->pgdir != 0 &&
+         (p->state == RUNNABLE || p->state == RUNNING || p->state == SLEEPING);
+}
+
+// Page out one user page to make room in memory. It is chosen by a
+// clock hand that sweeps the address spaces of all processes in
+// turn, giving pages used since its last sweep a second chance.
+// Returns -1 if no page could be paged out.
+int
+pageout(void)
+{
+  struct proc *p;
+  uint *pte;
+  char *mem;
+  int n, slot;
+
+  swapbegin();
+  acquire(&ptable.lock);
+  pte = 0;
+  for(n = 0; n <= 2*ptable.nproc; n++){
+    if(ptable.hand == 0){
+      ptable.hand = ptable.list;
+      ptable.handva = 0;
+    }
+    p = ptable.hand;
+    if(swappable(p)){
+      if((pte = coldpage(p->pgdir, &ptable.handva, p->sz)) != 0)
+        break;
+      // Make the accessed bits just cleared count from now on.
+      tlbflush(p->pgdir);
     }
+    ptable.hand = p->next;
+    ptable.handva = 0;
+  }
+  if(pte == 0 || (slot = swapalloc()) < 0){
+    release(&ptable.lock);
+    swapend();
+    return -1;
   }
+  mem = evictpte(p->pgdir, pte, slot);
+  ptable.handva += PGSIZE;
   release(&ptable.lock);
+  if(mem == 0)
+    swapfree(slot);
+  else {
+    swapwrite(slot, mem);
+    kfree(mem);
+  }
+  swapend();
+  return 0;
+}
 
-  if(pidCheck == 0){
-    cprintf("[setmemorylimit] pid doesn't exist!\n");
+// Futexes. A thread sleeps on one of NFUTEX channels chosen by
+// hashing the address space and user address of the futex word.
+// Unrelated futexes may share a channel, so callers must recheck
+// the word in a loop after futex_wait() returns.
+static void*
+futexchan(uint addr)
+{
+  uint h;
+
+  h = ((uint)myproc()->pgdir >> PTXSHIFT) ^ (addr >> 2);
+  return &ptable.futex[h % NFUTEX];
+}
+
+// Sleep until woken if *addr still holds val.
+// Return -1 right away if it does not.
+int
+futex_wait(int *addr, int val)
+{
+  struct proc *curproc = myproc();
+  uint va = PGROUNDDOWN((uint)addr);
+  char *page;
+
+  // Checking the word with ptable.lock held means a futex_wake()
+  // after the store that changed it cannot be missed. A fault with
+  // the lock held could not wait for swap, so the word is read
+  // through the kernel's mapping of its page, which pageout cannot
+  // take away without the lock.
+  for(;;){
+    acquire(&ptable.lock);
+    if((page = uva2ka(curproc->pgdir, (char*)va)) != 0)
+      break;
+    release(&ptable.lock);
+    if(faultuvm((uint)addr, sizeof(*addr), 0) < 0)
+      return -1;
+  }
+  if(*(int*)(page + ((uint)addr - va)) != val){
+    release(&ptable.lock);
     return -1;
   }
+  sleep(futexchan((uint)addr), &ptable.lock);
+  release(&ptable.lock);
+  if(curproc->killed)
+    return -1;
+  return 0;
+}
 
+// Wake every thread waiting on the futex at addr.
+int
+futex_wake(int *addr)
+{
+  wakeup(futexchan((uint)addr));
   return 0;
 }
 
 void
 pmanagerList()
 {
-  cprintf("-------------------------------------------------------------\n");
-  cprintf("|NAME           |PID       |STACKSIZE |MEMORY    |MEMLIM    |\n");
+  cprintf("-----------------------------------------------------------------------------------\n");
+  cprintf("|NAME           |PID       |STACKSIZE |STACKUSED |MEMORY    |MEMLIM    |SWAPPED   |\n");
   struct proc *p;
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.list; p; p = p->next){
     if(p->tid <= 0){ // no output in case of thread
       if(p->state == RUNNABLE || p->state == RUNNING || p->state == SLEEPING){
-        cprintf("-------------------------------------------------------------\n");
+        cprintf("-----------------------------------------------------------------------------------\n");
 
         int padding = 15 - strlen(p->name);
         cprintf("|%s", p->name);
@@ -649,14 +1532,18 @@ pmanagerList()
 
         alignedPrint(p->pid, 9);
         alignedPrint(p->stacksize, 9);
+        // Stack pages actually resident, out of stacksize.
+        alignedPrint(countuvm(p->pgdir, p->ustack - p->stacksize*PGSIZE, p->ustack), 9);
         alignedPrint(p->main->sz, 9);
         alignedPrint(p->memlim, 9);
+        // Pages on the swap device.
+        alignedPrint(countswap(p->pgdir, 0, p->main->sz), 9);
         cprintf("|\n");
       }
     }
   }
   release(&ptable.lock);
-  cprintf("-------------------------------------------------------------\n");
+  cprintf("-----------------------------------------------------------------------------------\n");
 }
 
 void
@@ -678,24 +1565,15 @@ thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg)
 {
   // acquire(&sbrklock);
   struct proc *np;
-  struct proc *p;
   struct proc *curproc = myproc();
   struct proc *main;
   int i;
+  thread_t tid;
   uint sz, sp, ustack[3+1];
   pde_t* pgdir;
 
   // cprintf("create thread!\n");
 
-  // Allocate thread
-  if((np = allocproc()) == 0){
-    cprintf("thread allocate failed!\n");
-    return -1;
-  }
-  nextpid--;
-
-  acquire(&ptable.lock);
-
   // Find main thread
   if(curproc->main != 0){
     main = curproc->main;
@@ -704,40 +1582,36 @@ thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg)
     main = curproc;
   }
 
-  // Allocate stack
-  // Make the first inaccessible. Use the second as the user stack.
-  sz = main->sz;
-  main->sz += 2*PGSIZE; 
-  // pgdir = main->pgdir;
-  pgdir = main->pgdir;
-  sz = PGROUNDUP(sz);
-  if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0){
-    cprintf("[thread_create] stack allocate failed!\n");
+  // Allocate thread
+  if((np = allocproc(main)) == 0){
+    cprintf("thread allocate failed!\n");
     return -1;
   }
-  clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
-  sp = sz;
-  main->sz = sz;
 
-  // Share page table
-  np->pgdir = main->pgdir;
+  acquire(&ptable.lock);
 
-  // Thread initialization
-  np->tid = nexttid;
-  *thread = np->tid;
-  nexttid++;
-  np->sz = main->sz;
-  np->parent = main->parent;
-  np->main = main;
-  np->pid = main->pid;
-  *np->tf = *main->tf;
+  // np is already visible as a thread of main, so an exit or exec
+  // may have started reaping the group (and picked a new main).
+  main = np->main;
+  if(main->exiting){
+    cprintf("[thread_create] process is exiting!\n");
+    goto bad;
+  }
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == main->pid){
-      p->sz = sz;
-      switchuvm(p);
-    }
+  // Allocate stack
+  // Leave a guard gap, then one page for the user stack.
+  pgdir = main->pgdir;
+  sz = PGROUNDUP(main->sz);
+  if(chargeuvm(main, 1) < 0){
+    cprintf("[thread_create] memory limit exceeded!\n");
+    goto bad;
   }
+  if(guarduvm(pgdir, sz) < 0 || allocuvm(pgdir, sz + PGSIZE, sz + 2*PGSIZE) == 0){
+    unchargeuvm(main, 1);
+    cprintf("[thread_create] stack allocate failed!\n");
+    goto bad;
+  }
+  sp = sz + 2*PGSIZE;
 
   // Set the stack of the new thread
   ustack[0] = 0xffffffff;  // fake return PC
@@ -746,9 +1620,23 @@ thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg)
   // Copies the contents of the ustack to the thread's stack area
   sp -= 8;
   if(copyout(pgdir, sp, ustack, 8) < 0){
+    deallocuvm(pgdir, sz + 2*PGSIZE, sz);
+    unchargeuvm(main, 1);
     cprintf("[thread_create] stack copy failed!\n");
-    return -1;
+    goto bad;
   }
+  sz += 2*PGSIZE;
+  main->sz = sz;
+
+  // Share page table
+  np->pgdir = main->pgdir;
+
+  // Thread initialization
+  tid = np->tid;
+  np->sz = main->sz;
+  np->parent = main->parent;
+  np->gang = main->gang;
+  *np->tf = *main->tf;
 
   // Commit to the user image.
   np->tf->eax = 0;
@@ -763,17 +1651,23 @@ thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg)
 
   safestrcpy(np->name, main->name, sizeof(main->name));
 
-  // switchuvm(main);
-  switchuvm(curproc);
-
   // Put the thread into RUNNABLE state
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&ptable.lock);
   // release(&sbrklock);
 
   // cprintf("create end!\n");
 
+  // thread is user memory, so not stored with ptable.lock held.
+  *thread = tid;
   return 0;
+
+bad:
+  freeproc(np);
+  // reapthreads() may be waiting for np to go away.
+  wakeup1(main);
+  release(&ptable.lock);
+  return -1;
 }
 
 void
@@ -807,7 +1701,7 @@ thread_exit(void *retval)
   }
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.list; p; p = p->next){
     if(p->parent == curproc){
       p->parent = initproc;
       if(p->state == ZOMBIE)
@@ -831,33 +1725,25 @@ thread_join(thread_t thread, void **retval)
   struct proc *p;
   struct proc *curproc = myproc();
   int havekids;
+  void *rv;
   
   acquire(&ptable.lock);
   for(;;){
     havekids = 0;
-    // Scan through table looking for thread
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->tid != thread)
-        continue;
+    // Look up the thread
+    if((p = findthread(thread)) != 0){
       havekids = 1;
-      // check = 1;
       if(p->state == ZOMBIE){
         // Found one.
-        // Save the return value
-        *retval = p->retval;
+        // Save the return value, but store it only after
+        // releasing the lock, in case that faults.
+        rv = p->retval;
 
         // Clear thread
-        kfree(p->kstack);
-        p->kstack = 0;
-        p->pid = 0;
-        p->tid = 0;
-        p->parent = 0;
-        p->main = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        freeproc(p);
 
         release(&ptable.lock);
+        *retval = rv;
         return 0;
       }
     }
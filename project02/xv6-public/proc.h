@@ -8,6 +8,7 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  pde_t *pgdir;                // Page table loaded in %cr3, or 0 for kpgdir
 };
 
 extern struct cpu cpus[NCPU];
@@ -32,6 +33,24 @@ struct context {
   uint eip;
 };
 
+// A loadable program segment or a mapped file, paged in from ip
+// on first touch.
+struct vmseg {
+  struct inode *ip;            // Program file, or 0 if unused
+  uint va;                     // Start address, page aligned
+  uint off;                    // File offset of va
+  uint filesz;                 // Bytes read from the file
+  uint memsz;                  // Bytes in memory; the rest are zero
+  int perm;                    // PTE_W if writable, PTE_SHM if shared
+};
+
+// A shared memory segment attached to a process.
+struct shmmap {
+  struct shmseg *seg;          // Segment, or 0 if unused
+  uint va;                     // Where it is mapped
+  uint sz;                     // Bytes mapped
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -49,11 +68,32 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
-  int stacksize;               // Number of stack pages
-  int memlim;                  // Memory limit
+  int stacksize;               // Most pages the stack may grow to
+  uint ustack;                 // Top of the user stack
+  int memlim;                  // Memory limit in bytes, 0 if none (main only)
   thread_t tid;                // Thread id
   struct proc *main;           // Main thread
   void *retval;                // Return value for thread join
+  int gang;                    // If non-zero, co-schedule all threads (main only)
+  uint gcputicks;              // Ticks used by all threads (main only)
+  uint fairepoch;              // FAIRDECAY period gcputicks was decayed to (main only)
+  int fairidx;                 // 1 + index in ptable.fairheap, 0 if not on it (main only)
+  uint fairseq;                // Orders groups of equal usage (main only)
+  struct proc *grq;            // RUNNABLE threads, oldest first (main only)
+  struct proc *grqtail;
+  uint rss;                    // Pages charged to memlim (main only)
+  int exiting;                 // Exit or exec is stopping the threads (main only)
+  int hugeheap;                // Back the heap with 4MB pages (main only)
+  struct vmseg seg[NSEG];      // Program segments (main only)
+  struct shmmap shm[NSHMMAP];  // Attached shared memory (main only)
+  struct vmseg mmap[NMMAP];    // Mapped files (main only)
+  struct proc *next;           // On ptable.list
+  struct proc *prev;
+  struct proc *rqnext;         // On ptable.runq if RUNNABLE
+  struct proc *rqprev;
+  struct proc *grnext;         // On main->grq if RUNNABLE
+  struct proc *grprev;
+  struct proc *hnext;          // On a pid or tid hash chain
 };
 
 // Process memory is laid out contiguously, low addresses first:
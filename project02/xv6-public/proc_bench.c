@@ -0,0 +1,67 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+#include "param.h"
+#include "memstat.h"
+
+// Times fork+exit+wait and thread_create+thread_join with the
+// kernel stack cache on and off. Both take a proc and a kernel
+// stack and give them back, so with the cache on every call after
+// the first should find a stack ready instead of calling kalloc.
+
+#define ROUNDS  1000
+
+void*
+worker(void *arg)
+{
+  thread_exit(arg);
+  return 0;
+}
+
+void
+run(int cache)
+{
+  thread_t t;
+  void *retval;
+  uint forks, threads;
+  int i;
+
+  setkcache(cache ? KC_ALL : KC_PAGES);
+  forks = rdtsc();
+  for(i = 0; i < ROUNDS; i++){
+    if(fork() == 0)
+      exit();
+    if(wait() < 0){
+      printf(1, "Test failed: fork %d failed\n", i);
+      exit();
+    }
+  }
+  forks = rdtsc() - forks;
+
+  threads = rdtsc();
+  for(i = 0; i < ROUNDS; i++){
+    if(thread_create(&t, worker, (void*)i) != 0 ||
+       thread_join(t, &retval) != 0 || retval != (void*)i){
+      printf(1, "Test failed: thread %d failed\n", i);
+      exit();
+    }
+  }
+  threads = rdtsc() - threads;
+  printf(1, "%s: fork+wait %d cycles/call, create+join %d cycles/call\n",
+         cache ? "kstack cache on " : "kstack cache off",
+         forks / ROUNDS, threads / ROUNDS);
+}
+
+int
+main(int argc, char *argv[])
+{
+  // Without KTUNE only the default, cache on, can be run.
+  if(setkcache(KC_ALL) < 0)
+    printf(1, "kernel built without KTUNE=1: kstack cache stays on\n");
+  else
+    run(0);
+  run(1);
+  printf(1, "Test passed\n");
+  exit();
+}
@@ -0,0 +1,73 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Fills the process table well past the old limit of 64 entries:
+// NCHILD forked children and NTHREAD threads are all alive at once,
+// blocked until the main thread lets them go. Each thread adds its
+// number to a sum and returns it, so a lost or mixed-up thread
+// shows up in the check at the end.
+
+#define NCHILD  100
+#define NTHREAD 2000
+
+thread_t tid[NTHREAD];
+volatile int go;
+int sum;
+
+void*
+worker(void *arg)
+{
+  while(!go)
+    futex_wait((int*)&go, 0);
+  __sync_fetch_and_add(&sum, (int)arg);
+  thread_exit(arg);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  void *retval;
+  int fds[2], i, n, want;
+  char c;
+
+  pipe(fds);
+  for(n = 0; n < NCHILD; n++){
+    if((i = fork()) < 0)
+      break;
+    if(i == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);
+      exit();
+    }
+  }
+  close(fds[0]);
+  printf(1, "%d children\n", n);
+
+  want = 0;
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_create(&tid[i], worker, (void*)i) != 0)
+      break;
+    want += i;
+  }
+  printf(1, "%d threads\n", i);
+  go = 1;
+  futex_wake((int*)&go);
+
+  close(fds[1]);
+  for(; n > 0; n--)
+    wait();
+
+  for(n = 0; n < i; n++){
+    if(thread_join(tid[n], &retval) != 0 || retval != (void*)n){
+      printf(1, "Test failed: thread %d did not join\n", n);
+      exit();
+    }
+  }
+  if(i == NTHREAD && sum == want)
+    printf(1, "Test passed\n");
+  else
+    printf(1, "Test failed: %d threads, sum %d, want %d\n", i, sum, want);
+  exit();
+}
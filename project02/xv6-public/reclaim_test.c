@@ -0,0 +1,62 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "param.h"
+#include "memstat.h"
+
+// Fills the page cache by mapping a few programs, then has a child
+// touch as many pages as are free. The cache should give its pages
+// back rather than the child running out of memory.
+
+char *files[] = { "cat", "echo", "grep", "ls", "sh", "wc" };
+
+void
+show(char *when, struct memstat *st)
+{
+  printf(1, "%s: %d free, %d cached, %d reclaimed, %d swapped out\n",
+         when, st->freepages, st->cachedpages, st->reclaimed, st->swapouts);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat before, after;
+  struct stat s;
+  int i, j, fd, n, sum;
+  char *p;
+
+  sum = 0;
+  for(i = 0; i < sizeof(files)/sizeof(files[0]); i++){
+    if((fd = open(files[i], O_RDONLY)) < 0 || fstat(fd, &s) < 0)
+      continue;
+    if((p = mmap(fd, 0, s.size, MAP_PRIVATE)) != (char*)-1){
+      for(j = 0; j < s.size; j += 4096)
+        sum += p[j];
+      munmap(p);
+    }
+    close(fd);
+  }
+  memstat(&before);
+  show("before", &before);
+
+  if(fork() == 0){
+    n = before.freepages;
+    if((p = sbrk(n*4096)) == (char*)-1){
+      printf(1, "sbrk failed!\n");
+      exit();
+    }
+    for(j = 0; j < n; j++)
+      p[j*4096] = j;
+    exit();
+  }
+  wait();
+  memstat(&after);
+  show("after", &after);
+
+  if(after.reclaimed > before.reclaimed)
+    printf(1, "Test passed (%d)\n", sum & 1);
+  else
+    printf(1, "Test failed: nothing was reclaimed\n");
+  exit();
+}
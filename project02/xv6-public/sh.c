@@ -3,6 +3,7 @@
 #include "types.h"
 #include "user.h"
 #include "fcntl.h"
+#include "param.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -53,6 +54,71 @@ int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
 
+// Free a parsed command.
+void
+freecmd(struct cmd *cmd)
+{
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
+
+// Start cmd with spawn if it is a single program, possibly with
+// redirections, so that the shell is not copied just to be thrown
+// away. The program reads from in and writes to out. Returns its
+// pid, -1 if it could not be started, or 0 if cmd needs a forked
+// shell to run it.
+int
+spawncmd(struct cmd *cmd, int in, int out)
+{
+  int fd[NOFILE], opened[NOFILE], i, n, pid;
+  struct execcmd *ecmd;
+  struct redircmd *rcmd;
+  struct cmd *c;
+
+  for(c = cmd; c->type == REDIR; c = ((struct redircmd*)c)->cmd)
+    ;
+  ecmd = (struct execcmd*)c;
+  if(c->type != EXEC || ecmd->argv[0] == 0)
+    return 0;
+
+  // Anything past stderr is the shell's own.
+  for(i = 0; i < NOFILE; i++)
+    fd[i] = i < 3 ? i : -1;
+  fd[0] = in;
+  fd[1] = out;
+  pid = -1;
+  for(n = 0, c = cmd; c->type == REDIR; c = rcmd->cmd){
+    rcmd = (struct redircmd*)c;
+    if(n == NOFILE || (opened[n] = open(rcmd->file, rcmd->mode)) < 0){
+      printf(2, "open %s failed\n", rcmd->file);
+      goto out;
+    }
+    fd[rcmd->fd] = opened[n++];
+  }
+  if((pid = spawn(ecmd->argv[0], ecmd->argv, 1, fd)) < 0)
+    printf(2, "exec %s failed\n", ecmd->argv[0]);
+
+out:
+  while(n > 0)
+    close(opened[--n]);
+  return pid;
+}
+
 // Execute cmd.  Never returns.
 void
 runcmd(struct cmd *cmd)
@@ -91,7 +157,7 @@ runcmd(struct cmd *cmd)
 
   case LIST:
     lcmd = (struct listcmd*)cmd;
-    if(fork1() == 0)
+    if(spawncmd(lcmd->left, 0, 1) == 0 && fork1() == 0)
       runcmd(lcmd->left);
     wait();
     runcmd(lcmd->right);
@@ -101,14 +167,14 @@ runcmd(struct cmd *cmd)
     pcmd = (struct pipecmd*)cmd;
     if(pipe(p) < 0)
       panic("pipe");
-    if(fork1() == 0){
+    if(spawncmd(pcmd->left, 0, p[1]) == 0 && fork1() == 0){
       close(1);
       dup(p[1]);
       close(p[0]);
       close(p[1]);
       runcmd(pcmd->left);
     }
-    if(fork1() == 0){
+    if(spawncmd(pcmd->right, p[0], 1) == 0 && fork1() == 0){
       close(0);
       dup(p[0]);
       close(p[0]);
@@ -123,7 +189,7 @@ runcmd(struct cmd *cmd)
 
   case BACK:
     bcmd = (struct backcmd*)cmd;
-    if(fork1() == 0)
+    if(spawncmd(bcmd->cmd, 0, 1) == 0 && fork1() == 0)
       runcmd(bcmd->cmd);
     break;
   }
@@ -145,7 +211,8 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  int fd, pid;
+  struct cmd *cmd;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,9 +231,13 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait();
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    if((pid = spawncmd(cmd, 0, 1)) == 0 && fork1() == 0)
+      runcmd(cmd);
+    if(pid >= 0)
+      wait();
+    freecmd(cmd);
   }
   exit();
 }
@@ -324,6 +395,17 @@ struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+// The shell parses commands itself, so a syntax error must not
+// exit it: the parser notes the first one and parsecmd returns 0.
+char *syntaxerr;
+
+void
+syntax(char *msg)
+{
+  if(syntaxerr == 0)
+    syntaxerr = msg;
+}
+
 struct cmd*
 parsecmd(char *s)
 {
@@ -335,7 +417,13 @@ parsecmd(char *s)
   peek(&s, es, "");
   if(s != es){
     printf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(syntaxerr){
+    printf(2, "%s\n", syntaxerr);
+    syntaxerr = 0;
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +467,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -406,7 +496,7 @@ parseblock(char **ps, char *es)
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
   if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+    syntax("syntax - missing )");
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +521,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc == MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -0,0 +1,220 @@
+// Shared memory segments.
+//
+// A segment is a set of zeroed pages that any process may map
+// into its address space, so that cooperating processes can pass
+// data without copying it through the kernel.
+//
+// Interface:
+// * shmget(key, size) returns the id of the segment with that key,
+//   creating it if there is none. Key 0 always creates a new one.
+// * shmat(id) maps the segment at the top of the heap and returns
+//   its address; shmdt(addr) unmaps it. Forked children inherit
+//   attachments, and exit and exec detach everything.
+//
+// The segment holds a reference to each of its pages and each
+// mapping holds another, so a page stays allocated while either
+// the segment or some page table uses it.
+//
+// Until its creator first attaches it, the segment belongs to the
+// creator, which is charged for it against its memory limit.
+// Other attachments charge the whole segment to the process that
+// attaches. The segment goes away once it has no attachments and
+// no owner, so one that nobody ever attaches goes away when its
+// creator exits or execs.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "proc.h"
+
+struct shmseg {
+  int key;
+  int npages;
+  int nattach;    // attachments in all processes
+  int owner;      // pid of the creator while it owns the segment, or 0
+  char **page;    // a page of page pointers; 0 if the slot is free
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+}
+
+// Drop the segment's pages. Caller holds shmtab.lock.
+static void
+shmfree(struct shmseg *s)
+{
+  int i;
+
+  for(i = 0; i < s->npages; i++)
+    kfree(s->page[i]);
+  kfree((char*)s->page);
+  s->page = 0;
+}
+
+int
+shmget(int key, uint size)
+{
+  struct proc *main = myproc()->main;
+  struct shmseg *s, *empty;
+  int n;
+
+  n = PGROUNDUP(size) / PGSIZE;
+  if(n == 0 || n > SHMMAXPG)
+    return -1;
+
+  acquire(&shmtab.lock);
+  empty = 0;
+  for(s = shmtab.seg; s < &shmtab.seg[NSHM]; s++){
+    if(s->page && key != 0 && s->key == key){
+      release(&shmtab.lock);
+      return n <= s->npages ? s - shmtab.seg : -1;
+    }
+    if(empty == 0 && s->page == 0)
+      empty = s;
+  }
+  if((s = empty) == 0 || chargeuvm(main, n) < 0)
+    goto bad;
+  if((s->page = (char**)kalloc()) == 0)
+    goto uncharge;
+  for(s->npages = 0; s->npages < n; s->npages++){
+    if((s->page[s->npages] = kzalloc()) == 0){
+      shmfree(s);
+      goto uncharge;
+    }
+  }
+  s->key = key;
+  s->nattach = 0;
+  s->owner = main->pid;
+  release(&shmtab.lock);
+  return s - shmtab.seg;
+
+uncharge:
+  unchargeuvm(main, n);
+bad:
+  release(&shmtab.lock);
+  return -1;
+}
+
+// Take an attachment of segment id. Returns 0 if there is none.
+struct shmseg*
+shmref(int id)
+{
+  struct shmseg *s;
+
+  if(id < 0 || id >= NSHM)
+    return 0;
+  s = &shmtab.seg[id];
+  acquire(&shmtab.lock);
+  if(s->page == 0)
+    s = 0;
+  else
+    s->nattach++;
+  release(&shmtab.lock);
+  return s;
+}
+
+int
+shmpages(struct shmseg *s)
+{
+  return s->npages;
+}
+
+// Map the pages of s at va in pgdir, which must have nothing
+// mapped there yet. On failure the caller unmaps what was mapped.
+int
+shmuvm(struct shmseg *s, pde_t *pgdir, uint va)
+{
+  int i;
+
+  for(i = 0; i < s->npages; i++)
+    if(shareuvm(pgdir, va + i*PGSIZE, s->page[i]) < 0)
+      return -1;
+  return 0;
+}
+
+// Take s over from its owner if that is pid. The owner's charge
+// then stands for its attachment. Returns whether it was pid's.
+int
+shmclaim(struct shmseg *s, int pid)
+{
+  int owned;
+
+  acquire(&shmtab.lock);
+  owned = (s->owner == pid);
+  if(owned)
+    s->owner = 0;
+  release(&shmtab.lock);
+  return owned;
+}
+
+// Give s back to pid after a failed attachment it had claimed.
+void
+shmunclaim(struct shmseg *s, int pid)
+{
+  acquire(&shmtab.lock);
+  s->owner = pid;
+  release(&shmtab.lock);
+}
+
+// Take another attachment of s, for a forked child.
+void
+shmdup(struct shmseg *s)
+{
+  acquire(&shmtab.lock);
+  s->nattach++;
+  release(&shmtab.lock);
+}
+
+// Drop an attachment of s, freeing it after the last one if
+// nobody owns it. The pages stay until every mapping of them is
+// gone too.
+void
+shmput(struct shmseg *s)
+{
+  acquire(&shmtab.lock);
+  if(--s->nattach == 0 && s->owner == 0)
+    shmfree(s);
+  release(&shmtab.lock);
+}
+
+// Give up the segments main owns, which is exiting or execing,
+// and free those that nobody has attached.
+void
+shmdisown(struct proc *main)
+{
+  struct shmseg *s;
+
+  acquire(&shmtab.lock);
+  for(s = shmtab.seg; s < &shmtab.seg[NSHM]; s++){
+    if(s->page == 0 || s->owner != main->pid)
+      continue;
+    s->owner = 0;
+    unchargeuvm(main, s->npages);
+    if(s->nattach == 0)
+      shmfree(s);
+  }
+  release(&shmtab.lock);
+}
+
+// Drop every attachment in m, whose mappings are being freed.
+void
+shmexit(struct shmmap *m)
+{
+  int i;
+
+  for(i = 0; i < NSHMMAP; i++){
+    if(m[i].seg){
+      shmput(m[i].seg);
+      m[i].seg = 0;
+    }
+  }
+}
@@ -0,0 +1,134 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+// A producer sends 16MB to a consumer through a pipe, then
+// through a ring of buffers in a shared memory segment. The pipe
+// copies every byte into the kernel and out again; the ring is
+// written and read in place. Processes cannot share futexes, so
+// the ring waits by spinning: run with CPUS=2 or more.
+
+#define MB      (1024*1024)
+#define TOTAL   (16*MB)
+#define CHUNK   4096
+#define NSLOT   16
+
+struct ring {
+  volatile uint head;   // chunks written
+  volatile uint tail;   // chunks read
+  char pad[CHUNK - 2*sizeof(uint)];
+  char slot[NSLOT][CHUNK];
+};
+
+char buf[CHUNK];
+
+void
+fill(char *p, int n)
+{
+  int i;
+
+  for(i = 0; i < CHUNK; i++)
+    p[i] = n + i;
+}
+
+uint
+sum(char *p)
+{
+  uint s;
+  int i;
+
+  s = 0;
+  for(i = 0; i < CHUNK; i++)
+    s = s*31 + (uchar)p[i];
+  return s;
+}
+
+uint
+bypipe(void)
+{
+  int fds[2], n, i;
+  uint s;
+
+  pipe(fds);
+  if(fork() == 0){
+    close(fds[0]);
+    for(n = 0; n < TOTAL/CHUNK; n++){
+      fill(buf, n);
+      write(fds[1], buf, CHUNK);
+    }
+    exit();
+  }
+  close(fds[1]);
+  s = 0;
+  for(n = 0; n < TOTAL/CHUNK; n++){
+    for(i = 0; i < CHUNK; i += read(fds[0], buf + i, CHUNK - i))
+      ;
+    s += sum(buf);
+  }
+  close(fds[0]);
+  wait();
+  return s;
+}
+
+uint
+byshm(void)
+{
+  struct ring *r;
+  uint n, s;
+  int id;
+
+  if((id = shmget(0, sizeof(*r))) < 0 || (r = shmat(id)) == (void*)-1){
+    printf(1, "shmget/shmat failed!\n");
+    exit();
+  }
+  if(fork() == 0){
+    for(n = 0; n < TOTAL/CHUNK; n++){
+      while(r->head - r->tail == NSLOT)
+        ;
+      fill(r->slot[n % NSLOT], n);
+      r->head = n + 1;
+    }
+    exit();
+  }
+  s = 0;
+  for(n = 0; n < TOTAL/CHUNK; n++){
+    while(r->head == n)
+      ;
+    s += sum(r->slot[n % NSLOT]);
+    r->tail = n + 1;
+  }
+  wait();
+  if(shmdt(r) < 0)
+    printf(1, "shmdt failed!\n");
+  return s;
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint t, ps, ss, want;
+  int n;
+
+  want = 0;
+  for(n = 0; n < TOTAL/CHUNK; n++){
+    fill(buf, n);
+    want += sum(buf);
+  }
+
+  t = rdtsc();
+  ps = bypipe();
+  t = rdtsc() - t;
+  printf(1, "pipe: %d Kcycles/MB\n", t / (TOTAL/MB) / 1000);
+
+  t = rdtsc();
+  ss = byshm();
+  t = rdtsc() - t;
+  printf(1, "shm:  %d Kcycles/MB\n", t / (TOTAL/MB) / 1000);
+
+  if(ps == want && ss == want)
+    printf(1, "Test passed\n");
+  else
+    printf(1, "Test failed: checksums differ\n");
+  exit();
+}
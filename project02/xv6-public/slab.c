@@ -0,0 +1,218 @@
+// Slab allocator for small kernel objects.
+//
+// Each cache hands out objects of one size, carved out of pages
+// from kalloc. A page of objects (a slab) starts with a struct
+// slab, so the slab and cache of an object can be found from
+// its address alone.
+//
+// Interface:
+// * slabcreate(name, size) makes a cache. Done once, at boot.
+// * slaballoc(c) returns an object of c, or 0 if out of memory.
+//   The contents are left over from its last use.
+// * slabfree(obj) gives it back.
+//
+// Each CPU keeps a magazine of up to MAGSIZE free objects per
+// cache, so that most allocations and frees take no lock. It
+// trades objects with the slabs MAGSIZE/2 at a time, holding
+// the cache lock. A slab whose objects are all free goes back
+// to kalloc unless it is the last one the cache has.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slabstat.h"
+
+#define MAGSIZE 16
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct slab {
+  struct slab *next;           // in cache's list of slabs
+  struct slabcache *cache;
+  void *free;                  // free objects, linked through their first word
+  int inuse;                   // objects not on free, counting magazines
+};
+
+struct slabcache {
+  struct spinlock lock;        // protects everything but mag
+  char name[SLABNAME];
+  uint size;                   // bytes per object
+  uint perslab;                // objects per slab
+  struct slab *slabs;
+  uint nslab;
+  uint inuse;                  // sum of slab->inuse
+  struct magazine mag[NCPU];   // only touched by its CPU, interrupts off
+};
+
+struct {
+  struct spinlock lock;
+  struct slabcache cache[NSLAB];
+  int n;
+} slabs;
+
+void
+slabinit(void)
+{
+  initlock(&slabs.lock, "slabs");
+}
+
+// Make a cache of size-byte objects.
+struct slabcache*
+slabcreate(char *name, uint size)
+{
+  struct slabcache *c;
+
+  size = (size + 3) & ~3;
+  if(size < sizeof(void*) || size > PGSIZE - sizeof(struct slab))
+    panic("slabcreate: size");
+  acquire(&slabs.lock);
+  if(slabs.n == NSLAB)
+    panic("slabcreate: too many caches");
+  c = &slabs.cache[slabs.n++];
+  release(&slabs.lock);
+
+  initlock(&c->lock, name);
+  safestrcpy(c->name, name, sizeof(c->name));
+  c->size = size;
+  c->perslab = (PGSIZE - sizeof(struct slab)) / size;
+  return c;
+}
+
+// Add a slab of free objects to c. Caller holds c->lock.
+static struct slab*
+newslab(struct slabcache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->free = 0;
+  s->inuse = 0;
+  obj = (char*)(s + 1);
+  for(i = 0; i < c->perslab; i++, obj += c->size){
+    *(void**)obj = s->free;
+    s->free = obj;
+  }
+  s->next = c->slabs;
+  c->slabs = s;
+  c->nslab++;
+  return s;
+}
+
+// Move up to n free objects from c's slabs to m.
+// Caller holds c->lock.
+static void
+fillmag(struct slabcache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  s = c->slabs;
+  while(n > 0){
+    if(s == 0 && (s = newslab(c)) == 0)
+      return;
+    if((obj = s->free) == 0){
+      s = s->next;
+      continue;
+    }
+    s->free = *(void**)obj;
+    s->inuse++;
+    c->inuse++;
+    m->obj[m->n++] = obj;
+    n--;
+  }
+}
+
+// Return obj to its slab. Caller holds c->lock.
+static void
+putobj(struct slabcache *c, void *obj)
+{
+  struct slab *s, **pp;
+
+  s = (struct slab*)PGROUNDDOWN((uint)obj);
+  *(void**)obj = s->free;
+  s->free = obj;
+  s->inuse--;
+  c->inuse--;
+  if(s->inuse > 0 || c->nslab == 1)
+    return;
+  for(pp = &c->slabs; *pp != s; pp = &(*pp)->next)
+    ;
+  *pp = s->next;
+  c->nslab--;
+  kfree((char*)s);
+}
+
+void*
+slaballoc(struct slabcache *c)
+{
+  struct magazine *m;
+  void *obj;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    fillmag(c, m, MAGSIZE/2);
+    release(&c->lock);
+  }
+  obj = 0;
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  popcli();
+  return obj;
+}
+
+void
+slabfree(void *obj)
+{
+  struct slabcache *c;
+  struct magazine *m;
+
+  c = ((struct slab*)PGROUNDDOWN((uint)obj))->cache;
+  if(c < slabs.cache || c >= &slabs.cache[slabs.n] || (uint)obj % PGSIZE == 0)
+    panic("slabfree");
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2)
+      putobj(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  popcli();
+}
+
+// Fill in usage of up to n caches. Returns how many there are.
+int
+slabinfo(struct slabstat *st, int n)
+{
+  struct slabcache *c;
+  struct slabstat s;
+  int i;
+
+  // st is user memory, so fill in s with the lock held and copy.
+  for(c = slabs.cache; c < &slabs.cache[slabs.n] && n > 0; c++, st++, n--){
+    acquire(&c->lock);
+    safestrcpy(s.name, c->name, sizeof(s.name));
+    s.size = c->size;
+    s.perslab = c->perslab;
+    s.slabs = c->nslab;
+    s.cached = 0;
+    for(i = 0; i < NCPU; i++)
+      s.cached += c->mag[i].n;
+    s.inuse = c->inuse - s.cached;
+    release(&c->lock);
+    *st = s;
+  }
+  return slabs.n;
+}
@@ -0,0 +1,72 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "slabstat.h"
+
+// Files, pipes and inodes come from slab caches that grow as
+// needed. Hold more open files than the old 100-entry file table
+// allowed, show the caches, and check that they shrink again.
+
+#define NCHILD  20
+#define NPIPE   5    // per child; 10 fds plus the three inherited
+
+struct slabstat st[NSLAB];
+
+int
+show(char *when, char *name)
+{
+  int i, n, inuse;
+
+  inuse = -1;
+  n = slabstat(st, NSLAB);
+  printf(1, "%s:\n", when);
+  printf(1, "  cache     size  perslab  slabs  inuse  cached\n");
+  for(i = 0; i < n; i++){
+    printf(1, "  %s\t  %d\t  %d\t   %d\t  %d\t  %d\n", st[i].name, st[i].size,
+           st[i].perslab, st[i].slabs, st[i].inuse, st[i].cached);
+    if(strcmp(st[i].name, name) == 0)
+      inuse = st[i].inuse;
+  }
+  return inuse;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, ready[2], go[2], fds[2], before, during, after;
+  char c;
+
+  before = show("before", "file");
+
+  pipe(ready);
+  pipe(go);
+  for(i = 0; i < NCHILD; i++){
+    if(fork() == 0){
+      close(go[1]);
+      for(j = 0; j < NPIPE; j++)
+        if(pipe(fds) < 0)
+          printf(1, "pipe failed!\n");
+      write(ready[1], "x", 1);
+      read(go[0], &c, 1);  // returns once the parent closes go
+      exit();
+    }
+  }
+  close(ready[1]);
+  close(go[0]);
+  for(i = 0; i < NCHILD; i++)
+    read(ready[0], &c, 1);
+
+  during = show("holding pipes", "file");
+  close(go[1]);
+  for(i = 0; i < NCHILD; i++)
+    wait();
+  close(ready[0]);
+  after = show("after", "file");
+
+  if(during - before >= NCHILD*NPIPE*2 && during > 100 && after <= before)
+    printf(1, "Test passed\n");
+  else
+    printf(1, "Test failed: %d, %d, %d files in use\n", before, during, after);
+  exit();
+}
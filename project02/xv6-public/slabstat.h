@@ -0,0 +1,11 @@
+#define SLABNAME 16
+
+// Usage of one slab cache, filled in by the slabstat system call.
+struct slabstat {
+  char name[SLABNAME];
+  uint size;          // Bytes per object
+  uint perslab;       // Objects per page
+  uint slabs;         // Pages the cache holds
+  uint inuse;         // Objects allocated
+  uint cached;        // Free objects held in per-CPU magazines
+};
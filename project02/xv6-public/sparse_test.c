@@ -0,0 +1,68 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// sbrk() only reserves address space; pages are allocated when
+// touched. A big sparse array should be cheap to create, and
+// only the touched pages should count against the memory limit.
+
+#define BIG    (64*1024*1024)
+#define STRIDE (64*4096)
+#define LIMIT  (4*1024*1024)
+
+int
+main(int argc, char *argv[])
+{
+  char *a;
+  int i, start, fds[2], pid;
+  char ok;
+
+  start = uptime();
+  if((a = sbrk(BIG)) == (char*)-1){
+    printf(1, "sbrk failed!\n");
+    exit();
+  }
+  printf(1, "sbrk(%d MB): %d ticks\n", BIG/(1024*1024), uptime() - start);
+
+  // Untouched memory reads as zero.
+  for(i = 0; i < BIG; i += STRIDE){
+    if(a[i] != 0){
+      printf(1, "Test 1 failed: page not zero\n");
+      exit();
+    }
+    a[i] = 1;
+  }
+  printf(1, "Test 1 passed\n");
+
+  // About 2MB of sparse touches fit under a 4MB limit even
+  // though the heap is 128MB.
+  if(setmemorylimit(getpid(), LIMIT) < 0){
+    printf(1, "Test 2 failed: setmemorylimit\n");
+    exit();
+  }
+  if((a = sbrk(BIG)) == (char*)-1){
+    printf(1, "Test 2 failed: sbrk\n");
+    exit();
+  }
+  for(i = 0; i < BIG; i += STRIDE)
+    a[i] = 2;
+  printf(1, "Test 2 passed\n");
+
+  // Touching more than the limit allows kills the process.
+  pipe(fds);
+  if((pid = fork()) == 0){
+    close(fds[0]);
+    for(i = 0; i < LIMIT; i += 4096)
+      a[i] = 3;
+    ok = 1;
+    write(fds[1], &ok, 1);
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &ok, 1) == 0)
+    printf(1, "Test 3 passed\n");
+  else
+    printf(1, "Test 3 failed: limit not enforced\n");
+  wait();
+  exit();
+}
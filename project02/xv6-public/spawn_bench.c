@@ -0,0 +1,61 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+// Starts the same do-nothing program ROUNDS times with fork and
+// exec, then with spawn. The parent first touches HEAP bytes, so
+// each fork has that much memory to share copy-on-write with a
+// child that throws it away at once; spawn does not look at it.
+
+#define ROUNDS  200
+#define HEAP    (8*1024*1024)
+
+char *args[] = { "spawn_bench", "child", 0 };
+
+int
+main(int argc, char *argv[])
+{
+  uint t, tf, ts;
+  char *p;
+  int i;
+
+  if(argc > 1)
+    exit();
+
+  if((p = sbrk(HEAP)) == (char*)-1){
+    printf(1, "sbrk failed!\n");
+    exit();
+  }
+  for(i = 0; i < HEAP; i += 4096)
+    p[i] = i;
+
+  t = rdtsc();
+  for(i = 0; i < ROUNDS; i++){
+    if(fork() == 0){
+      exec(args[0], args);
+      printf(1, "exec failed!\n");
+      exit();
+    }
+    wait();
+  }
+  tf = (rdtsc() - t) / ROUNDS / 1000;
+  printf(1, "fork+exec: %d Kcycles/process\n", tf);
+
+  t = rdtsc();
+  for(i = 0; i < ROUNDS; i++){
+    if(spawn(args[0], args, 1, 0) < 0){
+      printf(1, "Test failed: spawn failed\n");
+      exit();
+    }
+    wait();
+  }
+  ts = (rdtsc() - t) / ROUNDS / 1000;
+  printf(1, "spawn:     %d Kcycles/process\n", ts);
+
+  if(ts < tf)
+    printf(1, "Test passed\n");
+  else
+    printf(1, "Test failed: spawn was not faster\n");
+  exit();
+}
@@ -29,8 +29,12 @@ acquire(struct spinlock *lk)
     panic("acquire");
 
   // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  // Interrupts are off, so answer TLB shootdowns while waiting:
+  // the lock holder may be waiting for us to.
+  while(xchg(&lk->locked, 1) != 0){
+    lk->nspin++;
+    tlbpoll();
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -7,4 +7,5 @@ struct spinlock {
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+  uint nspin;        // Times acquire() found the lock held.
 };
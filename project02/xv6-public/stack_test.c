@@ -0,0 +1,75 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// exec2()'s stacksize is the most the stack may grow to. Deep
+// recursion within that limit succeeds; going past it hits the
+// guard gap and kills the process.
+
+#define DEPTH 16
+
+int
+recurse(int n)
+{
+  volatile char frame[1024];
+  int i;
+
+  // Touch the whole frame so that no page is skipped.
+  for(i = 0; i < sizeof(frame); i += 256)
+    frame[i] = n;
+  if(n == 0)
+    return 0;
+  return recurse(n - 1) + frame[0] - n;
+}
+
+// Run "stack_test deep fd" with the given stack size and report
+// whether it finished.
+int
+trydeep(int stacksize)
+{
+  char *argv[] = { "stack_test", "deep", "3", 0 };
+  int fds[2], pid;
+  char ok;
+
+  pipe(fds);
+  if((pid = fork()) == 0){
+    close(fds[0]);
+    if(fds[1] != 3){
+      close(3);
+      dup(fds[1]);
+      close(fds[1]);
+    }
+    exec2(argv[0], argv, stacksize);
+    printf(1, "exec2 failed!\n");
+    exit();
+  }
+  close(fds[1]);
+  ok = 0;
+  if(read(fds[0], &ok, 1) != 1)
+    ok = 0;
+  close(fds[0]);
+  wait();
+  return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char ok = 1;
+
+  if(argc > 2){
+    recurse(DEPTH);
+    write(atoi(argv[2]), &ok, 1);
+    exit();
+  }
+
+  if(trydeep(2 + DEPTH/2))
+    printf(1, "Test 1 passed\n");
+  else
+    printf(1, "Test 1 failed: stack did not grow\n");
+  if(!trydeep(2))
+    printf(1, "Test 2 passed\n");
+  else
+    printf(1, "Test 2 failed: stack grew past its limit\n");
+  exit();
+}
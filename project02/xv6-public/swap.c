@@ -0,0 +1,133 @@
+// Swap space.
+//
+// When memory runs out, user pages that have not been used lately
+// are written to the swap area, SWAPSIZE blocks that follow the
+// file system on the root disk, and read back when next touched.
+// The PTE of a page that is swapped out has PTE_P clear, PTE_SWAP
+// set and the swap slot number where the address would be.
+//
+// Interface:
+// * swapalloc, swapdup and swapfree manage the reference counts
+//   of slots; fork shares a swapped-out page by taking another.
+// * swapread and swapwrite move a page between memory and a slot.
+//   They bypass the log, since swap does not outlive a boot.
+// * swapbegin and swapend bracket moving a page in or out, so that
+//   a page being paged out is not read back before it is written.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "memstat.h"
+
+#define NSWAP (SWAPSIZE / (PGSIZE/BSIZE))
+
+struct {
+  struct spinlock lock;
+  struct sleeplock io;
+  ushort ref[NSWAP];    // mappings of each slot, at most NPROC; 0 if free
+  uint next;            // where to start looking for a free slot
+  uint nused;
+  uint nwrite;          // pages written
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.io, "swapio");
+}
+
+// Allocate a slot with one reference. Returns -1 if swap is full.
+int
+swapalloc(void)
+{
+  uint i, s;
+
+  acquire(&swap.lock);
+  for(i = 0; i < NSWAP; i++){
+    s = (swap.next + i) % NSWAP;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.next = s + 1;
+      swap.nused++;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0 || swap.ref[slot] == 0xFFFF)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+void
+swapbegin(void)
+{
+  acquiresleep(&swap.io);
+}
+
+void
+swapend(void)
+{
+  releasesleep(&swap.io);
+}
+
+void
+swapwrite(uint slot, char *mem)
+{
+  struct buf *b;
+  int i;
+
+  swap.nwrite++;
+  for(i = 0; i < PGSIZE/BSIZE; i++){
+    b = bread(ROOTDEV, FSSIZE + slot*(PGSIZE/BSIZE) + i);
+    memmove(b->data, mem + i*BSIZE, BSIZE);
+    bwrite(b);
+    brelse(b);
+  }
+}
+
+void
+swapread(uint slot, char *mem)
+{
+  struct buf *b;
+  int i;
+
+  for(i = 0; i < PGSIZE/BSIZE; i++){
+    b = bread(ROOTDEV, FSSIZE + slot*(PGSIZE/BSIZE) + i);
+    memmove(mem + i*BSIZE, b->data, BSIZE);
+    brelse(b);
+  }
+}
+
+void
+swapstat(struct memstat *st)
+{
+  st->swapslots = NSWAP;
+  st->swapused = swap.nused;
+  st->swapouts = swap.nwrite;
+}
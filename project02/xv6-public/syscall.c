@@ -19,7 +19,9 @@ fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(addr >= curproc->main->sz || addr+4 > curproc->main->sz)
+    return -1;
+  if(faultuvm(addr, 4, 0) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -34,11 +36,13 @@ fetchstr(uint addr, char **pp)
   char *s, *ep;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
+  if(addr >= curproc->main->sz)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
+  ep = (char*)curproc->main->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && faultuvm((uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -52,23 +56,38 @@ argint(int n, int *ip)
   return fetchint((myproc()->tf->esp) + 4 + 4*n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+static int
+fetchptr(int n, char **pp, int size, int write)
 {
   int i;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || (uint)i >= curproc->main->sz || (uint)i+size > curproc->main->sz)
+    return -1;
+  if(faultuvm(i, size, write) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes.  Check that the pointer
+// lies within the process address space.
+int
+argptr(int n, char **pp, int size)
+{
+  return fetchptr(n, pp, size, 0);
+}
+
+// Like argptr, for a block of memory the kernel will write to.
+int
+argwptr(int n, char **pp, int size)
+{
+  return fetchptr(n, pp, size, 1);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -110,6 +129,20 @@ extern int sys_thread_create(void);
 extern int sys_thread_exit(void);
 extern int sys_thread_join(void);
 extern int sys_exec_kill(void);
+extern int sys_setgang(void);
+extern int sys_setprocfair(void);
+extern int sys_futex_wait(void);
+extern int sys_futex_wake(void);
+extern int sys_memstat(void);
+extern int sys_setkcache(void);
+extern int sys_slabstat(void);
+extern int sys_sethugeheap(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_spawn(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -140,6 +173,20 @@ static int (*syscalls[])(void) = {
 [SYS_thread_exit]     sys_thread_exit,
 [SYS_thread_join]     sys_thread_join,
 [SYS_exec_kill]       sys_exec_kill,
+[SYS_setgang]         sys_setgang,
+[SYS_setprocfair]     sys_setprocfair,
+[SYS_futex_wait]      sys_futex_wait,
+[SYS_futex_wake]      sys_futex_wake,
+[SYS_memstat]         sys_memstat,
+[SYS_setkcache]       sys_setkcache,
+[SYS_slabstat]        sys_slabstat,
+[SYS_sethugeheap]     sys_sethugeheap,
+[SYS_shmget]          sys_shmget,
+[SYS_shmat]           sys_shmat,
+[SYS_shmdt]           sys_shmdt,
+[SYS_mmap]            sys_mmap,
+[SYS_munmap]          sys_munmap,
+[SYS_spawn]           sys_spawn,
 };
 
 void
@@ -27,3 +27,17 @@
 #define SYS_thread_exit     26
 #define SYS_thread_join     27
 #define SYS_exec_kill       28
+#define SYS_setgang         29
+#define SYS_setprocfair     30
+#define SYS_futex_wait      31
+#define SYS_futex_wake      32
+#define SYS_memstat         33
+#define SYS_setkcache       34
+#define SYS_slabstat        35
+#define SYS_sethugeheap     36
+#define SYS_shmget          37
+#define SYS_shmat           38
+#define SYS_shmdt           39
+#define SYS_mmap            40
+#define SYS_munmap          41
+#define SYS_spawn           42
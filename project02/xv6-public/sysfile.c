@@ -73,7 +73,7 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argwptr(1, &p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -109,7 +109,7 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argwptr(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
@@ -257,8 +257,10 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
-    panic("create: ialloc");
+  if((ip = ialloc(dp->dev, type)) == 0){
+    iunlockput(dp);
+    return 0;
+  }
 
   ilock(ip);
   ip->major = major;
@@ -267,15 +269,25 @@ create(char *path, short type, short major, short minor)
   iupdate(ip);
 
   if(type == T_DIR){  // Create . and .. entries.
-    dp->nlink++;  // for ".."
-    iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
     if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
       panic("create dots");
   }
 
-  if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+  // Fails if dirlookup above missed the name because iget had
+  // no memory. Free the new inode again.
+  if(dirlink(dp, name, ip->inum) < 0){
+    ip->nlink = 0;
+    iupdate(ip);
+    iunlockput(ip);
+    iunlockput(dp);
+    return 0;
+  }
+
+  if(type == T_DIR){
+    dp->nlink++;  // for ".."
+    iupdate(dp);
+  }
 
   iunlockput(dp);
 
@@ -446,6 +458,37 @@ sys_exec2(void)
   return exec2(path, argv, stacksize);
 }
 
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG];
+  int stacksize, *fdmap;
+  int i;
+  uint uargv, uarg, ufdmap;
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0 || argint(2, &stacksize) < 0 || argint(3, (int*)&ufdmap) < 0){
+    return -1;
+  }
+  fdmap = 0;
+  if(ufdmap != 0 && argptr(3, (char**)&fdmap, NOFILE*sizeof(int)) < 0){
+    return -1;
+  }
+  memset(argv, 0, sizeof(argv));
+  for(i=0;; i++){
+    if(i >= NELEM(argv))
+      return -1;
+    if(fetchint(uargv+4*i, (int*)&uarg) < 0)
+      return -1;
+    if(uarg == 0){
+      argv[i] = 0;
+      break;
+    }
+    if(fetchstr(uarg, &argv[i]) < 0)
+      return -1;
+  }
+  return spawn(path, argv, stacksize, fdmap);
+}
+
 int
 sys_pipe(void)
 {
@@ -453,7 +496,7 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argwptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
@@ -469,3 +512,52 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_mmap(void)
+{
+  struct file *f;
+  struct inode *ip;
+  int off, len, flags, perm, va;
+  uint filesz;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0 ||
+     argint(3, &flags) < 0)
+    return -1;
+  if(f->type != FD_INODE || !f->readable || off < 0 || off % PGSIZE != 0 || len <= 0)
+    return -1;
+  if(flags == MAP_SHARED)
+    perm = f->writable ? PTE_SHM|PTE_W : PTE_SHM;
+  else if(flags == MAP_PRIVATE)
+    perm = PTE_W;
+  else
+    return -1;
+
+  ip = idup(f->ip);
+  ilock(ip);
+  if(ip->type != T_FILE){
+    iunlock(ip);
+    goto bad;
+  }
+  filesz = off < ip->size ? ip->size - off : 0;
+  iunlock(ip);
+  if((va = mapfile(ip, off, len, filesz, perm)) < 0)
+    goto bad;
+  return va;
+
+bad:
+  begin_op();
+  iput(ip);
+  end_op();
+  return -1;
+}
+
+int
+sys_munmap(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return unmapfile(addr);
+}
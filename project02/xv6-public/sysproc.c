@@ -3,6 +3,8 @@
 #include "defs.h"
 #include "date.h"
 #include "param.h"
+#include "memstat.h"
+#include "slabstat.h"
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
@@ -60,7 +62,7 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
+  addr = myproc()->main->sz;
   if(growproc(n) < 0)
     return -1;
   return addr;
@@ -130,7 +132,7 @@ sys_thread_create(void)
   void *(*start_routine)(void *);
   void *arg;
 
-  if(argptr(0, (char **)&thread, sizeof(thread)) < 0){
+  if(argwptr(0, (char **)&thread, sizeof(thread)) < 0){
     return -1;
   }
   if(argptr(1, (char **)&start_routine, sizeof(start_routine)) < 0){
@@ -166,9 +168,156 @@ sys_thread_join(void)
   if(argint(0, &thread) < 0){
     return -1;
   }
-  if(argptr(1, (char **)&retval, sizeof(retval)) < 0){
+  if(argwptr(1, (char **)&retval, sizeof(retval)) < 0){
     return -1;
   }
   
   return thread_join((thread_t)thread,retval);
 }
+
+int
+sys_setgang(void)
+{
+  int pid, enable;
+
+  if(argint(0, &pid) < 0 || argint(1, &enable) < 0){
+    return -1;
+  }
+
+  return setgang(pid, enable);
+}
+
+int
+sys_setprocfair(void)
+{
+  int enable;
+
+  if(argint(0, &enable) < 0){
+    return -1;
+  }
+
+  return setprocfair(enable);
+}
+
+int
+sys_futex_wait(void)
+{
+  int *addr;
+  int val;
+
+  if(argptr(0, (char **)&addr, sizeof(*addr)) < 0 || argint(1, &val) < 0){
+    return -1;
+  }
+  if((uint)addr % sizeof(*addr) != 0){
+    return -1;
+  }
+
+  return futex_wait(addr, val);
+}
+
+int
+sys_futex_wake(void)
+{
+  int *addr;
+
+  if(argptr(0, (char **)&addr, sizeof(*addr)) < 0){
+    return -1;
+  }
+
+  return futex_wake(addr);
+}
+
+int
+sys_memstat(void)
+{
+  struct memstat *st;
+
+  if(argwptr(0, (char **)&st, sizeof(*st)) < 0){
+    return -1;
+  }
+
+  kmemstat(st);
+  swapstat(st);
+  return 0;
+}
+
+int
+sys_setkcache(void)
+{
+  int flags;
+
+  // Any process could slow the whole system down with this, so
+  // it is only there in kernels built for benchmarking.
+  if(!KTUNE){
+    return -1;
+  }
+  if(argint(0, &flags) < 0){
+    return -1;
+  }
+
+  return setkcache(flags);
+}
+
+int
+sys_slabstat(void)
+{
+  struct slabstat *st;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0 || n > NSLAB){
+    return -1;
+  }
+  if(argwptr(0, (char **)&st, n*sizeof(*st)) < 0){
+    return -1;
+  }
+
+  return slabinfo(st, n);
+}
+
+int
+sys_sethugeheap(void)
+{
+  int enable;
+
+  if(argint(0, &enable) < 0){
+    return -1;
+  }
+
+  return sethugeheap(enable);
+}
+
+int
+sys_shmget(void)
+{
+  int key, size;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0){
+    return -1;
+  }
+
+  return shmget(key, size);
+}
+
+int
+sys_shmat(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0){
+    return -1;
+  }
+
+  return shmattach(id);
+}
+
+int
+sys_shmdt(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0){
+    return -1;
+  }
+
+  return shmdetach(addr);
+}
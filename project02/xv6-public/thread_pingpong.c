@@ -0,0 +1,115 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Ping-pong a token between two contexts over a pair of pipes.
+// Each side touches every page of a shared working set before
+// passing the token on, so a TLB flush on every switch shows up
+// as extra page-walks. Threads share a page table and switch
+// without reloading %cr3; forked processes cannot.
+
+#define ROUNDS 2000
+#define NPAGE  64
+
+char buf[NPAGE*4096];
+int ping[2], pong[2];
+
+void
+touch(void)
+{
+  int i;
+
+  for(i = 0; i < NPAGE; i++)
+    buf[i*4096]++;
+}
+
+void
+side(int in, int out, int first)
+{
+  int i;
+  char c = 0;
+
+  for(i = 0; i < ROUNDS; i++){
+    if(!first || i > 0){
+      if(read(in, &c, 1) != 1){
+        printf(1, "read failed!\n");
+        exit();
+      }
+    }
+    touch();
+    if(write(out, &c, 1) != 1){
+      printf(1, "write failed!\n");
+      exit();
+    }
+  }
+}
+
+void *
+thread_pong(void *arg)
+{
+  side(ping[0], pong[1], 0);
+  thread_exit(0);
+  return 0;
+}
+
+int
+run_threads(void)
+{
+  thread_t t;
+  void *retval;
+  int start;
+
+  pipe(ping);
+  pipe(pong);
+  start = uptime();
+  if(thread_create(&t, thread_pong, 0) != 0){
+    printf(1, "thread_create failed!\n");
+    exit();
+  }
+  side(pong[0], ping[1], 1);
+  thread_join(t, &retval);
+  start = uptime() - start;
+  close(ping[0]); close(ping[1]);
+  close(pong[0]); close(pong[1]);
+  return start;
+}
+
+int
+run_procs(void)
+{
+  int pid, start;
+
+  pipe(ping);
+  pipe(pong);
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed!\n");
+    exit();
+  }
+  if(pid == 0){
+    side(ping[0], pong[1], 0);
+    exit();
+  }
+  // Start after fork so copying buf is not counted.
+  start = uptime();
+  side(pong[0], ping[1], 1);
+  wait();
+  start = uptime() - start;
+  close(ping[0]); close(ping[1]);
+  close(pong[0]); close(pong[1]);
+  return start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int t, p;
+
+  printf(1, "thread_pingpong: %d rounds, %d pages touched per side\n",
+         ROUNDS, NPAGE);
+  t = run_threads();
+  p = run_procs();
+  printf(1, "threads (shared pgdir):   %d ticks\n", t);
+  printf(1, "processes (cr3 reload):   %d ticks\n", p);
+  exit();
+}
@@ -0,0 +1,67 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// A thread keeps writing a counter while the main thread forks.
+// Fork makes the counter's page copy-on-write; unless the writer's
+// CPU flushes its TLB, the writer keeps writing the shared page and
+// the child sees its snapshot change. Run with CPUS=2 or more.
+
+#define FORKS   20
+#define CHECKS  200000
+
+volatile int stop;
+volatile uint counter;
+
+void*
+writer(void *arg)
+{
+  while(!stop)
+    counter++;
+  thread_exit(0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_t t;
+  void *retval;
+  int i, j, fds[2], bad;
+  uint v;
+  char ok;
+
+  if(thread_create(&t, writer, 0) != 0){
+    printf(1, "thread_create failed!\n");
+    exit();
+  }
+  bad = 0;
+  for(i = 0; i < FORKS; i++){
+    while(counter == 0)
+      ;
+    pipe(fds);
+    if(fork() == 0){
+      ok = 1;
+      v = counter;
+      for(j = 0; j < CHECKS; j++)
+        if(counter != v)
+          ok = 0;
+      write(fds[1], &ok, 1);
+      exit();
+    }
+    read(fds[0], &ok, 1);
+    wait();
+    close(fds[0]);
+    close(fds[1]);
+    if(!ok)
+      bad++;
+  }
+  stop = 1;
+  thread_join(t, &retval);
+
+  if(bad == 0)
+    printf(1, "Test passed\n");
+  else
+    printf(1, "Test failed: %d of %d children saw the parent's writes\n", bad, FORKS);
+  exit();
+}
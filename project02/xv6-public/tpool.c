@@ -0,0 +1,355 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+#include "tpool.h"
+
+#define SPINS 200  // failed work searches before a worker parks
+
+// Chase-Lev deque. Only the owning worker calls push and pop, at
+// the bottom; any thread may steal from the top. The buffer never
+// grows: push fails when it is full and the caller falls back.
+
+static int
+push(struct tp_deque *d, struct tp_task *t)
+{
+  int b;
+
+  b = d->bottom;
+  if(b - d->top >= TP_DEQUE)
+    return -1;
+  d->buf[b & (TP_DEQUE-1)] = *t;
+  __sync_synchronize();
+  d->bottom = b + 1;
+  return 0;
+}
+
+static int
+pop(struct tp_deque *d, struct tp_task *t)
+{
+  int b, top;
+
+  b = d->bottom - 1;
+  d->bottom = b;
+  __sync_synchronize();
+  top = d->top;
+  if(top > b){
+    // Empty.
+    d->bottom = b + 1;
+    return -1;
+  }
+  *t = d->buf[b & (TP_DEQUE-1)];
+  if(top < b)
+    return 0;
+  // Last task: race thieves for it.
+  if(!__sync_bool_compare_and_swap(&d->top, top, top + 1)){
+    d->bottom = b + 1;
+    return -1;
+  }
+  d->bottom = b + 1;
+  return 0;
+}
+
+static int
+steal(struct tp_deque *d, struct tp_task *t)
+{
+  int b, top;
+
+  top = d->top;
+  __sync_synchronize();
+  b = d->bottom;
+  if(top >= b)
+    return -1;
+  *t = d->buf[top & (TP_DEQUE-1)];
+  if(!__sync_bool_compare_and_swap(&d->top, top, top + 1))
+    return -1;
+  return 0;
+}
+
+static void
+lock(struct tpool *tp)
+{
+  while(xchg(&tp->lock, 1) != 0)
+    ;
+}
+
+static void
+unlock(struct tpool *tp)
+{
+  __sync_synchronize();
+  tp->lock = 0;
+}
+
+static int
+inject(struct tpool *tp, struct tp_task *t)
+{
+  int r = -1;
+
+  lock(tp);
+  if(tp->itail - tp->ihead < TP_INJECT){
+    tp->inject[tp->itail++ % TP_INJECT] = *t;
+    r = 0;
+  }
+  unlock(tp);
+  return r;
+}
+
+static int
+takeinject(struct tpool *tp, struct tp_task *t)
+{
+  int r = -1;
+
+  if(tp->ihead == tp->itail)
+    return -1;
+  lock(tp);
+  if(tp->ihead != tp->itail){
+    *t = tp->inject[tp->ihead++ % TP_INJECT];
+    r = 0;
+  }
+  unlock(tp);
+  return r;
+}
+
+// Return the index of the worker running this code, or -1.
+// Every worker runs on its own one-page thread stack.
+static int
+self(struct tpool *tp)
+{
+  uint page;
+  int i;
+
+  page = (uint)&page & ~(4096-1);
+  for(i = 0; i < tp->nworker; i++)
+    if(tp->worker[i].stackpage == page)
+      return i;
+  return -1;
+}
+
+static int
+findwork(struct tpool *tp, struct tp_worker *w, struct tp_task *t)
+{
+  int i, v;
+
+  if(pop(&w->deque, t) == 0)
+    return 0;
+  if(takeinject(tp, t) == 0)
+    return 0;
+  w->seed = w->seed * 1103515245 + 12345;
+  v = (w->seed >> 16) % tp->nworker;
+  for(i = 0; i < tp->nworker; i++, v = (v + 1) % tp->nworker){
+    if(v != w->id && steal(&tp->worker[v].deque, t) == 0)
+      return 0;
+  }
+  return -1;
+}
+
+static void
+run(struct tpool *tp, struct tp_task *t)
+{
+  t->fn(t->arg);
+  if(__sync_sub_and_fetch(&tp->pending, 1) == 0)
+    futex_wake((int*)&tp->pending);
+}
+
+static void
+wake(struct tpool *tp)
+{
+  __sync_synchronize();
+  if(tp->nparked > 0){
+    __sync_fetch_and_add(&tp->wakeseq, 1);
+    futex_wake((int*)&tp->wakeseq);
+  }
+}
+
+static void*
+worker(void *arg)
+{
+  struct tp_worker *w = arg;
+  struct tpool *tp = w->pool;
+  struct tp_task t;
+  int spins = 0, seq;
+
+  w->stackpage = (uint)&w & ~(4096-1);
+  for(;;){
+    if(findwork(tp, w, &t) == 0){
+      run(tp, &t);
+      spins = 0;
+      continue;
+    }
+    if(tp->stop)
+      break;
+    if(++spins < SPINS)
+      continue;
+
+    // Park. Count ourselves as parked before the last look for work,
+    // so a submit that comes after that look is sure to wake us.
+    seq = tp->wakeseq;
+    __sync_fetch_and_add(&tp->nparked, 1);
+    if(findwork(tp, w, &t) == 0){
+      __sync_fetch_and_sub(&tp->nparked, 1);
+      run(tp, &t);
+      continue;
+    }
+    if(!tp->stop)
+      futex_wait((int*)&tp->wakeseq, seq);
+    __sync_fetch_and_sub(&tp->nparked, 1);
+    spins = 0;
+  }
+  thread_exit(0);
+  return 0;
+}
+
+struct tpool*
+tp_create(int nworker)
+{
+  struct tpool *tp;
+  int i;
+
+  if(nworker < 1 || nworker > TP_MAXWORKER)
+    return 0;
+  if((tp = malloc(sizeof(*tp))) == 0)
+    return 0;
+  memset(tp, 0, sizeof(*tp));
+  tp->nworker = nworker;
+  for(i = 0; i < nworker; i++){
+    tp->worker[i].pool = tp;
+    tp->worker[i].id = i;
+    tp->worker[i].seed = i + 1;
+  }
+  for(i = 0; i < nworker; i++){
+    if(thread_create(&tp->thread[i], worker, &tp->worker[i]) != 0){
+      printf(2, "tp_create: thread_create failed\n");
+      tp->nworker = i;
+      tp_destroy(tp);
+      return 0;
+    }
+  }
+  return tp;
+}
+
+// Queue fn(arg) to run on a worker. Workers push onto their own
+// deque; everyone else uses the injection queue. If there is no
+// room, the task runs right away on the caller.
+void
+tp_submit(struct tpool *tp, void (*fn)(void*), void *arg)
+{
+  struct tp_task t;
+  int id;
+
+  t.fn = fn;
+  t.arg = arg;
+  __sync_fetch_and_add(&tp->pending, 1);
+  id = self(tp);
+  if(id >= 0 && push(&tp->worker[id].deque, &t) == 0){
+    wake(tp);
+    return;
+  }
+  if(inject(tp, &t) == 0){
+    wake(tp);
+    return;
+  }
+  run(tp, &t);
+}
+
+// Wait until every submitted task has finished. A task calling
+// this waits for all the other tasks, running them while it waits.
+void
+tp_wait(struct tpool *tp)
+{
+  struct tp_task t;
+  int id, n;
+
+  if((id = self(tp)) >= 0){
+    while(tp->pending > 1)
+      if(findwork(tp, &tp->worker[id], &t) == 0)
+        run(tp, &t);
+    return;
+  }
+  while((n = tp->pending) != 0)
+    futex_wait((int*)&tp->pending, n);
+}
+
+void
+tp_destroy(struct tpool *tp)
+{
+  void *retval;
+  int i;
+
+  tp_wait(tp);
+  tp->stop = 1;
+  __sync_fetch_and_add(&tp->wakeseq, 1);
+  futex_wake((int*)&tp->wakeseq);
+  for(i = 0; i < tp->nworker; i++)
+    thread_join(tp->thread[i], &retval);
+  free(tp);
+}
+
+// Parallel for. The caller and one helper task per worker take
+// grain-sized chunks of [lo, hi) from a shared counter until the
+// range is used up, so uneven chunks balance themselves.
+struct pfor {
+  struct tpool *tp;
+  void (*body)(int, int, void*);
+  void *arg;
+  int hi, grain;
+  volatile int next;
+  volatile int left;           // helpers not yet finished
+};
+
+static void
+pfor_chunks(struct pfor *pf)
+{
+  int lo, hi;
+
+  for(;;){
+    lo = __sync_fetch_and_add(&pf->next, pf->grain);
+    if(lo >= pf->hi)
+      break;
+    hi = lo + pf->grain;
+    if(hi > pf->hi)
+      hi = pf->hi;
+    pf->body(lo, hi, pf->arg);
+  }
+}
+
+static void
+pfor_helper(void *arg)
+{
+  struct pfor *pf = arg;
+
+  pfor_chunks(pf);
+  // pf lives on the caller's stack and may be gone after this.
+  if(__sync_sub_and_fetch(&pf->left, 1) == 0)
+    futex_wake((int*)&pf->left);
+}
+
+void
+tp_parallel_for(struct tpool *tp, int lo, int hi, int grain,
+                void (*body)(int, int, void*), void *arg)
+{
+  struct pfor pf;
+  struct tp_task t;
+  int i, id, n;
+
+  if(grain < 1)
+    grain = 1;
+  pf.tp = tp;
+  pf.body = body;
+  pf.arg = arg;
+  pf.hi = hi;
+  pf.grain = grain;
+  pf.next = lo;
+  pf.left = tp->nworker;
+  for(i = 0; i < tp->nworker; i++)
+    tp_submit(tp, pfor_helper, &pf);
+  pfor_chunks(&pf);
+
+  if((id = self(tp)) >= 0){
+    while(pf.left > 0)
+      if(findwork(tp, &tp->worker[id], &t) == 0)
+        run(tp, &t);
+    return;
+  }
+  while((n = pf.left) != 0)
+    futex_wait((int*)&pf.left, n);
+}
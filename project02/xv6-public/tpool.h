@@ -0,0 +1,48 @@
+// Work-stealing thread pool on top of thread_create().
+// A fixed set of worker LWPs each own a Chase-Lev deque. Workers
+// pop their own deque from the bottom and steal from the top of
+// the others; idle workers park on a futex. Tasks submitted from
+// outside the pool go through a shared injection queue.
+
+#define TP_MAXWORKER  16
+#define TP_DEQUE      256   // tasks per worker deque (power of 2)
+#define TP_INJECT     256   // tasks in the injection queue
+
+struct tp_task {
+  void (*fn)(void*);
+  void *arg;
+};
+
+struct tp_deque {
+  volatile int top;
+  volatile int bottom;
+  struct tp_task buf[TP_DEQUE];
+};
+
+struct tp_worker {
+  struct tpool *pool;
+  int id;
+  uint stackpage;              // identifies the calling worker
+  uint seed;                   // picks steal victims
+  struct tp_deque deque;
+};
+
+struct tpool {
+  int nworker;
+  volatile int stop;
+  volatile int pending;        // submitted but not finished tasks
+  volatile int nparked;        // workers sleeping in futex_wait
+  volatile int wakeseq;        // futex word for parked workers
+  volatile uint lock;          // protects the injection queue
+  int ihead, itail;
+  struct tp_task inject[TP_INJECT];
+  thread_t thread[TP_MAXWORKER];
+  struct tp_worker worker[TP_MAXWORKER];
+};
+
+struct tpool* tp_create(int nworker);
+void tp_submit(struct tpool*, void (*fn)(void*), void *arg);
+void tp_wait(struct tpool*);
+void tp_destroy(struct tpool*);
+void tp_parallel_for(struct tpool*, int lo, int hi, int grain,
+                     void (*body)(int, int, void*), void *arg);
@@ -0,0 +1,102 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "tpool.h"
+
+// Checksum files in parallel, one tp_submit() task per file,
+// repeated for 1..N workers. Every file in the current directory is used.
+
+#define NFILES  64
+#define ROUNDS  5
+
+char name[NFILES][DIRSIZ+1];
+uint cksum[NFILES];
+int nfile;
+
+// Adler-32 of the whole file.
+void
+adler(void *arg)
+{
+  int i = (int)arg, fd, n, k;
+  uint a = 1, b = 0;
+  uchar buf[512];
+
+  if((fd = open(name[i], 0)) < 0){
+    cksum[i] = 0;
+    return;
+  }
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    for(k = 0; k < n; k++){
+      a = (a + buf[k]) % 65521;
+      b = (b + a) % 65521;
+    }
+  }
+  close(fd);
+  cksum[i] = (b << 16) | a;
+}
+
+void
+listdir(char *path)
+{
+  struct dirent de;
+  struct stat st;
+  int fd;
+
+  if((fd = open(path, 0)) < 0){
+    printf(1, "tpool_cksum: cannot open %s\n", path);
+    exit();
+  }
+  while(read(fd, &de, sizeof(de)) == sizeof(de) && nfile < NFILES){
+    if(de.inum == 0)
+      continue;
+    memmove(name[nfile], de.name, DIRSIZ);
+    name[nfile][DIRSIZ] = 0;
+    if(stat(name[nfile], &st) < 0 || st.type != T_FILE)
+      continue;
+    nfile++;
+  }
+  close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct tpool *tp;
+  int i, r, nw, maxw, start;
+  uint all, first = 0;
+
+  maxw = 4;
+  if(argc > 1)
+    maxw = atoi(argv[1]);
+  if(maxw < 1 || maxw > TP_MAXWORKER){
+    printf(1, "usage: tpool_cksum [max workers <= %d]\n", TP_MAXWORKER);
+    exit();
+  }
+
+  listdir(".");
+  printf(1, "tpool_cksum: %d files, %d rounds\n", nfile, ROUNDS);
+  for(nw = 1; nw <= maxw; nw++){
+    if((tp = tp_create(nw)) == 0){
+      printf(1, "tp_create failed!\n");
+      exit();
+    }
+    start = uptime();
+    for(r = 0; r < ROUNDS; r++){
+      for(i = 0; i < nfile; i++)
+        tp_submit(tp, adler, (void*)i);
+      tp_wait(tp);
+    }
+    all = 0;
+    for(i = 0; i < nfile; i++)
+      all ^= cksum[i];
+    if(nw == 1)
+      first = all;
+    printf(1, "%d workers: %d ticks (checksum %x)\n",
+           nw, uptime() - start, all);
+    if(all != first)
+      printf(1, "checksum mismatch!\n");
+    tp_destroy(tp);
+  }
+  exit();
+}
@@ -0,0 +1,69 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "tpool.h"
+
+// Parallel sum of a large array with tp_parallel_for(), repeated
+// for 1..N workers. Run with different CPUS to see the scaling.
+
+#define N       (1 << 20)
+#define ROUNDS  10
+#define GRAIN   4096
+
+int *data;
+volatile int total;
+
+void
+sum(int lo, int hi, void *arg)
+{
+  int i, s = 0;
+
+  for(i = lo; i < hi; i++)
+    s += data[i];
+  __sync_fetch_and_add(&total, s);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct tpool *tp;
+  int i, nw, maxw, start, expect;
+
+  maxw = 4;
+  if(argc > 1)
+    maxw = atoi(argv[1]);
+  if(maxw < 1 || maxw > TP_MAXWORKER){
+    printf(1, "usage: tpool_sum [max workers <= %d]\n", TP_MAXWORKER);
+    exit();
+  }
+
+  if((data = malloc(N * sizeof(int))) == 0){
+    printf(1, "malloc failed!\n");
+    exit();
+  }
+  expect = 0;
+  for(i = 0; i < N; i++){
+    data[i] = i & 0xff;
+    expect += data[i];
+  }
+
+  printf(1, "tpool_sum: %d ints, %d rounds\n", N, ROUNDS);
+  for(nw = 1; nw <= maxw; nw++){
+    if((tp = tp_create(nw)) == 0){
+      printf(1, "tp_create failed!\n");
+      exit();
+    }
+    start = uptime();
+    for(i = 0; i < ROUNDS; i++){
+      total = 0;
+      tp_parallel_for(tp, 0, N, GRAIN, sum, 0);
+      if(total != expect){
+        printf(1, "wrong sum %d, expected %d\n", total, expect);
+        exit();
+      }
+    }
+    printf(1, "%d workers: %d ticks\n", nw, uptime() - start);
+    tp_destroy(tp);
+  }
+  exit();
+}
@@ -56,6 +56,10 @@ trap(struct trapframe *tf)
     }
     lapiceoi();
     break;
+  case T_TLBFLUSH:
+    tlbpoll();
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE:
     ideintr();
     lapiceoi();
@@ -78,6 +82,11 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    if(pagefault(rcr2(), tf->err) == 0)
+      break;
+    // pagefault could not resolve it; fall through and report it.
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
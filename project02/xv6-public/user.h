@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct memstat;
+struct slabstat;
 
 // system calls
 int fork(void);
@@ -30,6 +32,20 @@ int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg);
 void thread_exit(void *retval);
 int thread_join(thread_t thread, void **retval);
 int exec_kill(int);
+int setgang(int, int);
+int setprocfair(int);
+int futex_wait(int*, int);
+int futex_wake(int*);
+int memstat(struct memstat*);
+int setkcache(int);
+int slabstat(struct slabstat*, int);
+int sethugeheap(int);
+int shmget(int, int);
+void* shmat(int);
+int shmdt(void*);
+void* mmap(int, int, int, int);
+int munmap(void*);
+int spawn(char*, char**, int, int*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -6,6 +6,8 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "traps.h"
+#include "spinlock.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -27,11 +29,54 @@ seginit(void)
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
   lgdt(c->gdt, sizeof(c->gdt));
+
+  // Load the TSS once; switchuvm() only has to update esp0.
+  c->gdt[SEG_TSS] = SEG16(STS_T32A, &c->ts, sizeof(c->ts)-1, 0);
+  c->gdt[SEG_TSS].s = 0;
+  c->ts.ss0 = SEG_KDATA << 3;
+  // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
+  // forbids I/O instructions (e.g., inb and outb) from user space
+  c->ts.iomb = (ushort) 0xFFFF;
+  ltr(SEG_TSS << 3);
+}
+
+#define HUGEORDER 10  // kallocn order of a 4MB page
+
+// Return the page directory entry for va if it maps a 4MB page.
+static pde_t*
+hugepde(pde_t *pgdir, uint va)
+{
+  pde_t *pde;
+
+  pde = &pgdir[PDX(va)];
+  return (*pde & PTE_PS) ? pde : 0;
+}
+
+// Replace the 4MB page mapped by *pde with a page table that
+// maps the same 4KB pages, so that they can be handled one at a
+// time. Each already holds its own reference, from kallocn.
+static int
+splitpde(pde_t *pde)
+{
+  pte_t *pgtab;
+  uint old, i;
+
+  old = *pde;
+  if((pgtab = (pte_t*)kalloc()) == 0)
+    return -1;
+  for(i = 0; i < NPTENTRIES; i++)
+    pgtab[i] = (PTE_ADDR(old) + i*PGSIZE) | (old & (PTE_W|PTE_U)) | PTE_P;
+  // Another thread may have split it first.
+  if(!__sync_bool_compare_and_swap(pde, old, V2P(pgtab) | PTE_P | PTE_W | PTE_U))
+    kfree((char*)pgtab);
+  return 0;
 }
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page table pages.
+// create any required page table pages, splitting a 4MB
+// page if need be. Callers that pass alloc=0 must check
+// for 4MB pages themselves.
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -39,17 +84,22 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if((*pde & PTE_PS) && (!alloc || splitpde(pde) < 0))
+    return 0;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
+    // kzalloc makes sure all those PTE_P bits are zero.
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
       return 0;
-    // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
-    // entries, if necessary.
-    *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+    // entries, if necessary. Threads faulting at the same time
+    // may race to install the page table; the loser frees its own.
+    if(!__sync_bool_compare_and_swap(pde, 0, V2P(pgtab) | PTE_P | PTE_W | PTE_U)){
+      kfree((char*)pgtab);
+      pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
+    }
   }
   return &pgtab[PTX(va)];
 }
@@ -79,6 +129,31 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   return 0;
 }
 
+// Like mappages, but map the 4MB-aligned parts with 4MB pages.
+// Only for the kernel part of a page table.
+static int
+mapkvm(pde_t *pgdir, char *va, uint size, uint pa, int perm)
+{
+  uint n;
+
+  while(size > 0){
+    if((uint)va % HUGESZ == 0 && pa % HUGESZ == 0 && size >= HUGESZ){
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS;
+      n = HUGESZ;
+    } else {
+      n = HUGESZ - (uint)va % HUGESZ;
+      if(n > size)
+        n = size;
+      if(mappages(pgdir, va, n, pa, perm) < 0)
+        return -1;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -92,13 +167,15 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
-//   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP,
+//   data..KERNBASE+phystop: mapped to V2P(data)..phystop,
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and the end of physical memory (phystop, found
+// by kinit1) (directly addressable from end..P2V(phystop)).
+// Memory and devices are mapped with 4MB pages where aligned, so
+// the kernel part of a page table needs only one page table page.
 
 // This table defines the kernel's mappings, which are present in
 // every process's page table.
@@ -110,7 +187,7 @@ static struct kmap {
 } kmap[] = {
  { (void*)KERNBASE, 0,             EXTMEM,    PTE_W}, // I/O space
  { (void*)KERNLINK, V2P(KERNLINK), V2P(data), 0},     // kern text+rodata
- { (void*)data,     V2P(data),     PHYSTOP,   PTE_W}, // kern data+memory
+ { (void*)data,     V2P(data),     0,         PTE_W}, // kern data+memory, to phystop
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
@@ -121,25 +198,91 @@ setupkvm(void)
   pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kzalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
+    if(mapkvm(pgdir, k->virt, k->phys_end - k->phys_start,
+              (uint)k->phys_start, k->perm) < 0) {
       freevm(pgdir);
       return 0;
     }
   return pgdir;
 }
 
+// TLB shootdown. After changing PTEs of a page table that other
+// CPUs may have loaded, a CPU sends them T_TLBFLUSH and waits
+// until each one has reloaded %cr3. c->pgdir tells which CPUs to
+// ask; a CPU that loads the page table later sees the new PTEs.
+// A CPU spinning in acquire() has interrupts off and cannot take
+// the IPI, so it checks for requests with tlbpoll() as it spins.
+struct {
+  struct spinlock lock;        // one shootdown at a time
+  volatile uint pending;       // CPUs (by index) yet to flush
+} tlb;
+
+// Flush pgdir's entries from the TLBs of all other CPUs that
+// have it loaded. Skipped when none do.
+void
+tlbshootdown(pde_t *pgdir)
+{
+  struct cpu *c, *me;
+  uint mask;
+
+  pushcli();
+  me = mycpu();
+  // Make our PTE changes visible before reading c->pgdir.
+  __sync_synchronize();
+  mask = 0;
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c != me && c->pgdir == pgdir)
+      mask |= 1 << (c - cpus);
+  if(mask){
+    acquire(&tlb.lock);
+    tlb.pending = mask;
+    for(c = cpus; c < cpus+ncpu; c++)
+      if(mask & (1 << (c - cpus)))
+        lapicipi(c->apicid, T_TLBFLUSH);
+    while(tlb.pending & mask)
+      ;
+    release(&tlb.lock);
+  }
+  popcli();
+}
+
+// Flush pgdir's entries from every TLB, this CPU's included.
+void
+tlbflush(pde_t *pgdir)
+{
+  pushcli();
+  if(mycpu()->pgdir == pgdir)
+    lcr3(V2P(pgdir));
+  popcli();
+  tlbshootdown(pgdir);
+}
+
+// Reload %cr3 if another CPU has asked us to. Called on
+// T_TLBFLUSH and while spinning for a lock, with interrupts off.
+void
+tlbpoll(void)
+{
+  uint bit;
+
+  if(tlb.pending == 0)
+    return;
+  bit = 1 << cpuid();
+  if(tlb.pending & bit){
+    lcr3(rcr3());
+    __sync_fetch_and_and(&tlb.pending, ~bit);
+  }
+}
+
 // Allocate one page table for the machine for the kernel address
 // space for scheduler processes.
 void
 kvmalloc(void)
 {
+  initlock(&tlb.lock, "tlb");
+  kmap[2].phys_end = phystop;
   kpgdir = setupkvm();
   switchkvm();
 }
@@ -153,9 +296,13 @@ switchkvm(void)
 }
 
 // Switch TSS and h/w page table to correspond to process p.
+// Threads of one process share a pgdir, so %cr3 (and with it
+// the whole TLB) is only reloaded when the pgdir changes.
 void
 switchuvm(struct proc *p)
 {
+  struct cpu *c;
+
   if(p == 0)
     panic("switchuvm: no process");
   if(p->kstack == 0)
@@ -164,16 +311,12 @@ switchuvm(struct proc *p)
     panic("switchuvm: no pgdir");
 
   pushcli();
-  mycpu()->gdt[SEG_TSS] = SEG16(STS_T32A, &mycpu()->ts,
-                                sizeof(mycpu()->ts)-1, 0);
-  mycpu()->gdt[SEG_TSS].s = 0;
-  mycpu()->ts.ss0 = SEG_KDATA << 3;
-  mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
-  // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
-  // forbids I/O instructions (e.g., inb and outb) from user space
-  mycpu()->ts.iomb = (ushort) 0xFFFF;
-  ltr(SEG_TSS << 3);
-  lcr3(V2P(p->pgdir));  // switch to process's address space
+  c = mycpu();
+  c->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
+  if(c->pgdir != p->pgdir){
+    c->pgdir = p->pgdir;
+    lcr3(V2P(p->pgdir));  // switch to process's address space
+  }
   popcli();
 }
 
@@ -186,36 +329,11 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
-{
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
-  }
-  return 0;
-}
-
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -231,13 +349,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -248,33 +365,65 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
-// Deallocate user pages to bring the process size from oldsz to
-// newsz.  oldsz and newsz need not be page-aligned, nor does newsz
-// need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
-int
-deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
+// Unmap the user pages in [lo, hi). With dofree=0 the entries
+// only lose PTE_P and keep their addresses; with dofree=1 the
+// pages are freed and the entries cleared.
+static void
+unmapuvm(pde_t *pgdir, uint lo, uint hi, int dofree)
 {
+  pde_t *pde;
   pte_t *pte;
   uint a, pa;
 
-  if(newsz >= oldsz)
-    return oldsz;
-
-  a = PGROUNDUP(newsz);
-  for(; a  < oldsz; a += PGSIZE){
+  for(a = lo; a < hi; a += PGSIZE){
+    if((pde = hugepde(pgdir, a)) != 0){
+      if(a % HUGESZ == 0 && a + HUGESZ <= hi){
+        if(dofree){
+          kfreen(P2V(PTE_ADDR(*pde)), HUGEORDER);
+          *pde = 0;
+        } else
+          *pde &= ~PTE_P;
+        a += HUGESZ - PGSIZE;
+        continue;
+      }
+      // Unmapping part of it. Without memory for a page table,
+      // keep all of it until the process exits.
+      if(dofree || splitpde(pde) < 0){
+        a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+        continue;
+      }
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
-    else if((*pte & PTE_P) != 0){
-      pa = PTE_ADDR(*pte);
-      if(pa == 0)
-        panic("kfree");
-      char *v = P2V(pa);
-      kfree(v);
+    else if(!dofree)
+      *pte &= ~PTE_P;
+    else {
+      if(*pte & PTE_SWAP)
+        swapfree(PTE_SLOT(*pte));
+      else if((pa = PTE_ADDR(*pte)) != 0)
+        kfree(P2V(pa));
       *pte = 0;
     }
   }
+}
+
+// Deallocate user pages to bring the process size from oldsz to
+// newsz.  oldsz and newsz need not be page-aligned, nor does newsz
+// need to be less than oldsz.  oldsz can be larger than the actual
+// process size.  Returns the new process size.
+int
+deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  if(newsz >= oldsz)
+    return oldsz;
+
+  // Other CPUs may still have the pages in their TLBs, so they
+  // can only be freed after a shootdown. Doing it in two passes
+  // lets one shootdown cover any number of pages.
+  unmapuvm(pgdir, PGROUNDUP(newsz), oldsz, 0);
+  tlbflush(pgdir);
+  unmapuvm(pgdir, PGROUNDUP(newsz), oldsz, 1);
   return newsz;
 }
 
@@ -289,7 +438,7 @@ freevm(pde_t *pgdir)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
   for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+    if((pgdir[i] & PTE_P) && !(pgdir[i] & PTE_PS)){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
     }
@@ -297,38 +446,81 @@ freevm(pde_t *pgdir)
   kfree((char*)pgdir);
 }
 
-// Clear PTE_U on a page. Used to create an inaccessible
-// page beneath the user stack.
-void
-clearpteu(pde_t *pgdir, char *uva)
+// Mark the page at uva as a guard gap. It is never mapped, and
+// touching it is an error rather than a reason to allocate it.
+int
+guarduvm(pde_t *pgdir, uint uva)
 {
   pte_t *pte;
 
-  pte = walkpgdir(pgdir, uva, 0);
-  if(pte == 0)
-    panic("clearpteu");
-  *pte &= ~PTE_U;
+  if((pte = walkpgdir(pgdir, (char*)uva, 1)) == 0)
+    return -1;
+  *pte = PTE_GUARD;
+  return 0;
+}
+
+// Map the shared memory page mem at uva, writable. The mapping
+// takes its own reference to mem.
+int
+shareuvm(pde_t *pgdir, uint uva, char *mem)
+{
+  kincref(mem);
+  if(mappages(pgdir, (char*)uva, PGSIZE, V2P(mem), PTE_W|PTE_U|PTE_SHM) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. User pages are not copied: both page
+// tables map them read-only and copy-on-write, and the caller
+// must flush its TLB since the parent's entries changed.
+// Shared memory pages stay writable in both.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
+  pte_t *pte, *pte2;
   uint pa, i, flags;
   char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    // 4MB pages are shared copy-on-write 4KB at a time.
+    if(hugepde(pgdir, i) && splitpde(hugepde(pgdir, i)) < 0)
+      goto bad;
+    // Pages never touched are still lazily allocated in the child.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(!(*pte & PTE_P)){
+      if((*pte & PTE_GUARD) && guarduvm(d, i) < 0)
+        goto bad;
+      // Both share the swapped-out copy until they read it back.
+      if(*pte & PTE_SWAP){
+        if((pte2 = walkpgdir(d, (void*)i, 1)) == 0)
+          goto bad;
+        swapdup(PTE_SLOT(*pte));
+        *pte2 = *pte;
+      }
+      continue;
+    }
+    if((*pte & (PTE_U|PTE_W|PTE_SHM)) == (PTE_U|PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
+    if(flags & PTE_U){
+      kincref(P2V(pa));
+      if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0) {
+        kfree(P2V(pa));
+        goto bad;
+      }
+      continue;
+    }
+    // Stack guard pages are never touched; just copy them.
     if((mem = kalloc()) == 0)
       goto bad;
     memmove(mem, (char*)P2V(pa), PGSIZE);
@@ -344,15 +536,497 @@ bad:
   return 0;
 }
 
+// Charge n newly resident pages to main, the main thread of a
+// process, unless that would take it over its memory limit.
+// Sibling threads charge concurrently, hence the compare-and-swap.
+int
+chargeuvm(struct proc *main, int n)
+{
+  uint old;
+
+  do {
+    old = main->rss;
+    if(main->memlim && (old + n) * PGSIZE > main->memlim)
+      return -1;
+  } while(!__sync_bool_compare_and_swap(&main->rss, old, old + n));
+  return 0;
+}
+
+void
+unchargeuvm(struct proc *main, int n)
+{
+  __sync_fetch_and_sub(&main->rss, n);
+}
+
+// Charge the page a fault is about to map. A fault the kernel
+// takes on a user buffer cannot fail, so that page is granted
+// anyway and the process is killed before it runs user code again.
+static int
+chargefault(struct proc *main, uint err)
+{
+  if(chargeuvm(main, 1) == 0)
+    return 0;
+  if(err & FEC_U)
+    return -1;
+  __sync_fetch_and_add(&main->rss, 1);
+  myproc()->killed = 1;
+  return 0;
+}
+
+// Does the caller hold a spinlock, and so must not wait for
+// the disk?
+static int
+nosleep(void)
+{
+  int locked;
+
+  pushcli();
+  locked = mycpu()->ncli > 1;
+  popcli();
+  return locked;
+}
+
+// Page out a page to make room, unless the caller holds a
+// spinlock and so cannot wait for the disk.
+static int
+reclaim(void)
+{
+  if(nosleep())
+    return -1;
+  return pageout();
+}
+
+// Allocate a page of user memory, zeroed if zero is set, paging
+// out other user pages if memory is full.
+static char*
+userpage(int zero)
+{
+  char *mem;
+
+  while((mem = zero ? kzalloc() : kalloc()) == 0)
+    if(reclaim() < 0)
+      return 0;
+  return mem;
+}
+
+// Give the page table a private, writable copy of the
+// copy-on-write page whose PTE is pte. If no one else maps
+// the page any more it is simply made writable again. Threads
+// may race here, so the PTE is only updated if it is unchanged.
+static int
+cowpage(pte_t *pte, uint va, uint err)
+{
+  uint old, pa;
+  char *mem;
+  int charged;
+
+  old = *pte;
+  if((old & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return 0;
+  pa = PTE_ADDR(old);
+  if(krefcount(P2V(pa)) == 1){
+    __sync_bool_compare_and_swap(pte, old, (old | PTE_W) & ~PTE_COW);
+    invlpg((void*)va);
+    return 0;
+  }
+  // The zero page is not charged to those that map it, so a
+  // first write to it is charged like a fresh page.
+  charged = (P2V(pa) == zeropg);
+  if(charged && chargefault(myproc()->main, err) < 0)
+    return -1;
+  if((mem = userpage(charged)) == 0){
+    if(charged)
+      unchargeuvm(myproc()->main, 1);
+    return -1;
+  }
+  if(!charged)
+    memmove(mem, P2V(pa), PGSIZE);
+  if(!__sync_bool_compare_and_swap(pte, old,
+                                   V2P(mem) | ((PTE_FLAGS(old) | PTE_W) & ~PTE_COW))){
+    kfree(mem);  // someone else got here first
+    if(charged)
+      unchargeuvm(myproc()->main, 1);
+    return 0;
+  }
+  // Other threads may still have the old page in their TLBs
+  // and read it; flush them before it can be reused.
+  invlpg((void*)va);
+  tlbshootdown(myproc()->pgdir);
+  kfree(P2V(pa));
+  return 0;
+}
+
+// Map mem at va for a page fault, unless another thread mapped
+// the page first, in which case drop mem and its charge.
+static int
+faultmap(struct proc *main, uint va, char *mem, int perm, int charged)
+{
+  pte_t *pte;
+
+  while((pte = walkpgdir(main->pgdir, (char*)va, 1)) == 0)
+    if(reclaim() < 0)
+      break;
+  if(pte == 0 || !__sync_bool_compare_and_swap(pte, 0, V2P(mem) | PTE_P | PTE_U | perm)){
+    kfree(mem);
+    if(charged)
+      unchargeuvm(main, 1);
+    return pte ? 0 : -1;
+  }
+  return 0;
+}
+
+// Map the 4MB-aligned block around va with a single zeroed 4MB
+// page, if the process asked for that with sethugeheap() and the
+// block lies wholly in its heap with nothing in it mapped yet.
+// Returns -1 if the caller should map a 4KB page instead.
+static int
+hugepage(struct proc *main, uint va)
+{
+  struct vmseg *s;
+  pde_t *pde;
+  uint base;
+  char *mem;
+
+  base = va & ~(HUGESZ-1);
+  pde = &main->pgdir[PDX(va)];
+  if(!main->hugeheap || base < main->ustack || base + HUGESZ > main->sz || *pde != 0)
+    return -1;
+  for(s = main->mmap; s < &main->mmap[NMMAP]; s++)
+    if(s->ip && s->va < base + HUGESZ && base < s->va + s->memsz)
+      return -1;
+  if(chargeuvm(main, NPTENTRIES) < 0)
+    return -1;
+  if((mem = kallocn(HUGEORDER)) == 0){
+    unchargeuvm(main, NPTENTRIES);
+    return -1;
+  }
+  memset(mem, 0, HUGESZ);
+  if(!__sync_bool_compare_and_swap(pde, 0, V2P(mem) | PTE_P | PTE_W | PTE_U | PTE_PS)){
+    kfreen(mem, HUGEORDER);
+    unchargeuvm(main, NPTENTRIES);
+    if(*pde == 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Map a zeroed page at va, which sbrk() reserved but nobody has
+// touched yet.
+static int
+zeropage(struct proc *main, uint va, uint err)
+{
+  char *mem;
+
+  if(hugepage(main, va) == 0)
+    return 0;
+  // Reading maps the shared zero page; cowpage gives the process
+  // a page of its own on the first write.
+  if(!(err & FEC_WR))
+    return faultmap(main, va, zeropg, PTE_COW, 0);
+  if(chargefault(main, err) < 0)
+    return -1;
+  if((mem = userpage(1)) == 0){
+    unchargeuvm(main, 1);
+    return -1;
+  }
+  return faultmap(main, va, mem, PTE_W, 1);
+}
+
+// Page in va of program segment or mapped file s. A page that lies
+// wholly inside the file comes from the page cache, so every process
+// running the program shares it until it writes to it. The page
+// holding the end of a program's file data is private, since the
+// rest of it must be zero; that of a shared mapping is not, as the
+// cache zeroes past the end of the file. Shared pages of a read-only
+// program segment are not charged to anyone: the page cache can
+// always drop them once they are unmapped. All others are, even
+// while shared, so that copy-on-write never has to fail.
+static int
+segpage(struct proc *main, struct vmseg *s, uint va, uint err)
+{
+  char *mem;
+  uint n, perm;
+  int charged;
+
+  n = va - s->va;
+  if(n >= s->filesz)
+    return zeropage(main, va, err);
+  // Reading the file sleeps.
+  if(nosleep())
+    return -1;
+  n = s->filesz - n;
+  charged = (n < PGSIZE || (s->perm & (PTE_W|PTE_SHM)));
+  if(charged && chargefault(main, err) < 0)
+    return -1;
+
+  perm = s->perm;
+  ilock(s->ip);
+  if(n >= PGSIZE || (perm & PTE_SHM)){
+    mem = pcget(s->ip, s->off + (va - s->va));
+    if((perm & (PTE_W|PTE_SHM)) == PTE_W)
+      perm = PTE_COW;
+  } else if((mem = userpage(1)) != 0){
+    if(readi(s->ip, mem, s->off + (va - s->va), n) != n){
+      kfree(mem);
+      mem = 0;
+    }
+  }
+  iunlock(s->ip);
+  if(mem == 0){
+    if(charged)
+      unchargeuvm(main, 1);
+    return -1;
+  }
+  return faultmap(main, va, mem, perm, charged);
+}
+
+// Read back the swapped-out page whose PTE is pte. The page stays
+// charged to the process while it is swapped out.
+static int
+swappage(pte_t *pte)
+{
+  char *mem;
+  uint old;
+
+  // Reading the disk sleeps.
+  if(nosleep())
+    return -1;
+  if((mem = userpage(0)) == 0)
+    return -1;
+  swapbegin();
+  old = *pte;
+  if((old & PTE_SWAP) == 0){
+    // Another thread read it back first.
+    swapend();
+    kfree(mem);
+    return 0;
+  }
+  swapread(PTE_SLOT(old), mem);
+  if(!__sync_bool_compare_and_swap(pte, old, V2P(mem) | (PTE_FLAGS(old) & ~PTE_SWAP) | PTE_P)){
+    // Unmapped meanwhile, which dropped the slot.
+    swapend();
+    kfree(mem);
+    return 0;
+  }
+  swapend();
+  swapfree(PTE_SLOT(old));
+  return 0;
+}
+
+// Handle a page fault at address va with error code err in the
+// current process, from user or kernel mode. Returns 0 if the
+// faulting instruction can be retried, -1 if the fault is real.
+int
+pagefault(uint va, uint err)
+{
+  struct proc *curproc = myproc();
+  struct vmseg *s;
+  pte_t *pte;
+
+  if(curproc == 0 || va >= curproc->main->sz)
+    return -1;
+  va = PGROUNDDOWN(va);
+  // 4MB pages are always present and writable.
+  if(hugepde(curproc->pgdir, va))
+    return 0;
+  pte = walkpgdir(curproc->pgdir, (void*)va, 0);
+  if(pte == 0 || *pte == 0){
+    for(s = curproc->main->seg; s < &curproc->main->seg[NSEG]; s++)
+      if(s->ip && va >= s->va && va - s->va < s->memsz)
+        return segpage(curproc->main, s, va, err);
+    for(s = curproc->main->mmap; s < &curproc->main->mmap[NMMAP]; s++)
+      if(s->ip && va >= s->va && va - s->va < s->memsz)
+        return segpage(curproc->main, s, va, err);
+    return zeropage(curproc->main, va, err);
+  }
+  if(*pte & PTE_SWAP)
+    return swappage(pte);
+  if((err & FEC_WR) && (*pte & PTE_COW))
+    return cowpage(pte, va, err);
+  // Another thread may have just resolved the same fault.
+  if((*pte & (PTE_P|PTE_U)) == (PTE_P|PTE_U) &&
+     (!(err & FEC_WR) || (*pte & PTE_W)))
+    return 0;
+  return -1;
+}
+
+// Fault in any pages of [va, va+len) that the current process
+// has not touched yet, and if the kernel is going to write to
+// them, any it has only read as the zero page. System calls do
+// this before using a user buffer, so that running out of memory
+// or over the limit is an error return rather than a fault the
+// kernel cannot fail. A buffer the kernel only reads can stay on
+// the zero page.
+int
+faultuvm(uint va, uint len, int write)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    if(hugepde(myproc()->pgdir, a))
+      continue;
+    pte = walkpgdir(myproc()->pgdir, (char*)a, 0);
+    // Passing FEC_U lets the fault fail rather than overrun the limit.
+    if((pte == 0 || *pte == 0 || (*pte & PTE_SWAP) ||
+        (write && (*pte & PTE_P) && P2V(PTE_ADDR(*pte)) == zeropg)) &&
+       pagefault(a, FEC_U | (write ? FEC_WR : 0)) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Write back the n pages at dirty in shared file mapping s,
+// once no TLB can still hold their old dirty bits.
+static void
+syncpages(pde_t *pgdir, struct vmseg *s, uint *dirty, int n)
+{
+  pte_t *pte;
+  int i;
+
+  tlbflush(pgdir);
+  for(i = 0; i < n; i++){
+    pte = walkpgdir(pgdir, (char*)dirty[i], 0);
+    if(pte && (*pte & PTE_P))
+      pcsync(s->ip, s->off + (dirty[i] - s->va), P2V(PTE_ADDR(*pte)));
+  }
+}
+
+// Write back the pages of shared file mapping s that have been
+// written to, as the dirty bit in their PTEs shows. The bit is
+// cleared before the page is written, so that a store made after
+// that marks it dirty again for the next sync.
+void
+syncuvm(pde_t *pgdir, struct vmseg *s)
+{
+  pte_t *pte;
+  uint a, dirty[16];
+  int n;
+
+  if(!(s->perm & PTE_SHM))
+    return;
+  n = 0;
+  for(a = s->va; a < s->va + s->filesz; a += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(!pte)
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    else if((*pte & (PTE_P|PTE_D|PTE_SHM)) == (PTE_P|PTE_D|PTE_SHM)){
+      __sync_fetch_and_and(pte, ~PTE_D);
+      dirty[n++] = a;
+      if(n == NELEM(dirty)){
+        syncpages(pgdir, s, dirty, n);
+        n = 0;
+      }
+    }
+  }
+  if(n > 0)
+    syncpages(pgdir, s, dirty, n);
+}
+
+// Number of pages between lo and hi whose PTEs have any of bits.
+static int
+countpte(pde_t *pgdir, uint lo, uint hi, uint bits)
+{
+  pte_t *pte;
+  uint a;
+  int n;
+
+  n = 0;
+  for(a = PGROUNDUP(lo); a < hi; a += PGSIZE){
+    if(hugepde(pgdir, a)){
+      if(bits & PTE_P)
+        n++;
+      continue;
+    }
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(!pte)
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    else if((*pte & bits) && !((*pte & PTE_P) && P2V(PTE_ADDR(*pte)) == zeropg))
+      n++;
+  }
+  return n;
+}
+
+// Number of pages between lo and hi that are actually mapped,
+// in memory or swapped out. Mappings of the zero page are free.
+int
+countuvm(pde_t *pgdir, uint lo, uint hi)
+{
+  return countpte(pgdir, lo, hi, PTE_P|PTE_SWAP);
+}
+
+// Number of pages between lo and hi that are swapped out.
+int
+countswap(pde_t *pgdir, uint lo, uint hi)
+{
+  return countpte(pgdir, lo, hi, PTE_SWAP);
+}
+
+// Look for a page in [*va, hi) of pgdir that can be paged out and
+// has not been used since the clock hand last passed it, clearing
+// the accessed bits of the pages passed over. Only private pages
+// mapped nowhere else qualify. Returns its PTE, with *va set to its
+// address, or 0 with *va set to hi.
+pte_t*
+coldpage(pde_t *pgdir, uint *va, uint hi)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = *va; a < hi; a += PGSIZE){
+    if(hugepde(pgdir, a)){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P|PTE_U|PTE_SHM)) != (PTE_P|PTE_U) ||
+       krefcount(P2V(PTE_ADDR(*pte))) != 1)
+      continue;
+    if(*pte & PTE_A){
+      __sync_fetch_and_and(pte, ~PTE_A);
+      continue;
+    }
+    *va = a;
+    return pte;
+  }
+  *va = hi;
+  return 0;
+}
+
+// Replace the mapping in pte, of pgdir, with swap slot slot and
+// return the page it mapped, which the caller writes to the slot
+// and frees. Returns 0 if the PTE changed meanwhile.
+char*
+evictpte(pde_t *pgdir, pte_t *pte, uint slot)
+{
+  uint old;
+
+  old = *pte;
+  if(!(old & PTE_P) ||
+     !__sync_bool_compare_and_swap(pte, old, (slot << PTXSHIFT) | (PTE_FLAGS(old) & ~PTE_P) | PTE_SWAP))
+    return 0;
+  tlbflush(pgdir);
+  return P2V(PTE_ADDR(old));
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
 uva2ka(pde_t *pgdir, char *uva)
 {
+  pde_t *pde;
   pte_t *pte;
 
+  if((pde = hugepde(pgdir, (uint)uva)) != 0){
+    if((*pde & PTE_U) == 0)
+      return 0;
+    return (char*)P2V(PTE_ADDR(*pde)) + ((uint)uva & (HUGESZ-1));
+  }
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -367,10 +1041,14 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    pte = hugepde(pgdir, va0) ? 0 : walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_COW) && cowpage(pte, va0, 0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
@@ -0,0 +1,77 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+#include "param.h"
+#include "memstat.h"
+
+// Page fault and fork latency with and without the pages that
+// idle CPUs zero ahead of time. Each round sleeps first so that
+// the pools can fill up, then times only the faults or the fork.
+// Turning off the per-CPU lists also turns the pools off.
+
+#define PAGES   128
+#define ROUNDS  20
+#define HEAP    (4*1024*1024)
+
+void
+run(int pool)
+{
+  struct memstat before, after;
+  uint faults, forks, t;
+  char *p;
+  int i, r, pid;
+
+  setkcache(pool ? KC_ALL : KC_KSTACKS);
+  sleep(5);
+  memstat(&before);
+  faults = forks = 0;
+  for(r = 0; r < ROUNDS; r++){
+    sleep(1);
+    p = sbrk(PAGES*4096);
+    t = rdtsc();
+    for(i = 0; i < PAGES; i++)
+      p[i*4096] = 1;
+    faults += rdtsc() - t;
+    sbrk(-PAGES*4096);
+
+    sleep(1);
+    t = rdtsc();
+    if((pid = fork()) < 0){
+      printf(1, "fork failed!\n");
+      exit();
+    }
+    if(pid == 0)
+      exit();
+    forks += rdtsc() - t;
+    wait();
+  }
+  memstat(&after);
+  printf(1, "%s: %d cycles/fault, %d cycles/fork, %d zeroed ahead, %d on demand\n",
+         pool ? "zero pool on " : "zero pool off",
+         faults / (ROUNDS*PAGES), forks / ROUNDS,
+         after.zerohit - before.zerohit, after.zeromiss - before.zeromiss);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *heap;
+  int i;
+
+  // Give fork some page tables to copy.
+  if((heap = sbrk(HEAP)) == (char*)-1){
+    printf(1, "sbrk failed!\n");
+    exit();
+  }
+  for(i = 0; i < HEAP; i += 4096)
+    heap[i] = 1;
+
+  // Without KTUNE only the default, pools on, can be run.
+  if(setkcache(KC_ALL) < 0)
+    printf(1, "kernel built without KTUNE=1: zero pools stay on\n");
+  else
+    run(0);
+  run(1);
+  exit();
+}
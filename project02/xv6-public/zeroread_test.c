@@ -0,0 +1,44 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "memstat.h"
+
+// Reading a large untouched array should map one shared zero page
+// everywhere, costing only page tables; writing it should not.
+
+#define SIZE    (32*1024*1024)
+#define PAGES   (SIZE/4096)
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat st;
+  uint before, afterread, afterwrite;
+  char *p;
+  int i, sum;
+
+  memstat(&st);
+  before = st.freepages;
+  if((p = sbrk(SIZE)) == (char*)-1){
+    printf(1, "sbrk failed!\n");
+    exit();
+  }
+  sum = 0;
+  for(i = 0; i < SIZE; i += 4096)
+    sum += p[i];
+  memstat(&st);
+  afterread = st.freepages;
+  for(i = 0; i < SIZE; i += 4096)
+    p[i] = 1;
+  memstat(&st);
+  afterwrite = st.freepages;
+
+  printf(1, "pages used: %d after reading %d pages, %d after writing them\n",
+         before - afterread, PAGES, before - afterwrite);
+  if(sum == 0 && before - afterread < PAGES/64 && before - afterwrite >= PAGES)
+    printf(1, "Test passed\n");
+  else
+    printf(1, "Test failed\n");
+  exit();
+}